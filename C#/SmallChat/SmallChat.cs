@@ -457,7 +457,7 @@ namespace SmallChat
                             {
                                 case SCPduType.Hello:
                                     {
-                                        info.Nickname = pdu.Encoding.GetString(pdu.Payload);
+                                        info.Nickname = pdu.Encoding.GetString(pdu.Payload).Split('\0')[0];
                                         this.ManualSend(endPoint.Address, new SCPdu(this.myself.ChatID, SCPduType.Welcome, Encoding.Default, Encoding.Default.GetBytes(this.myself.Nickname)));
                                         if (this.Add(info, true) && this.OnHello != null)
                                         {
@@ -468,7 +468,7 @@ namespace SmallChat
 
                                 case SCPduType.Welcome:
                                     {
-                                        info.Nickname = pdu.Encoding.GetString(pdu.Payload);
+                                        info.Nickname = pdu.Encoding.GetString(pdu.Payload).Split('\0')[0];
                                         if (this.Add(info, true) && this.OnWelcome != null)
                                         {
                                             this.OnWelcome(info);
@@ -0,0 +1,94 @@
+﻿/*
+	Copyright (C) 2015 - Code written 100% by Valentino Giudice
+	E-mail: valentino.giudice96@gmail.com
+	Website: http://valentinogiudice.altervista.org/
+	Twitter: http://twitter.com/aspie96
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+	EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+	(This work is also licensed under the GNU General Public License as published by the Free Software Foundation, either version 2 of the License, or, at your option, any later version).
+*/
+
+using System;
+using System.IO;
+using System.Linq;
+using SmallChat;
+
+namespace Test
+{
+    /// <summary>Checks the <see cref="SCEDA"/> class against the known answer vectors generated by the C implementation (test-vectors/sceda.txt).</summary>
+    static class KnownAnswers
+    {
+        private static byte[] ParseHex(string hex)
+        {
+            if (hex == "-")
+            {
+                return new byte[0];
+            }
+            return Enumerable.Range(0, hex.Length / 2).Select(i => Convert.ToByte(hex.Substring(2 * i, 2), 16)).ToArray();
+        }
+
+        /// <summary>Checks every vector in a file and writes the result to the console.</summary>
+        /// <param name="path">The path of the file of vectors.</param>
+        /// <returns><c>true</c> if all the vectors have been checked successfully, <c>false</c> otherwise.</returns>
+        public static bool Check(string path)
+        {
+            int checkedCount = 0;
+            int failedCount = 0;
+            foreach (string line in File.ReadLines(path))
+            {
+                if (line.Length == 0 || line[0] == '#')
+                {
+                    continue;
+                }
+                string[] fields = line.Split(' ');
+                bool passed;
+                try
+                {
+                    if (fields[0] == "digest" && fields.Length == 3)
+                    {
+                        passed = SCEDA.Digest(ParseHex(fields[1])).SequenceEqual(ParseHex(fields[2]));
+                    }
+                    else if (fields[0] == "decrypt" && fields.Length == 5)
+                    {
+                        passed = SCEDA.Decrypt(ParseHex(fields[3]), ParseHex(fields[1]), ParseHex(fields[2])).SequenceEqual(ParseHex(fields[4]));
+                    }
+                    else
+                    {
+                        Console.WriteLine("Malformed vector: " + line);
+                        passed = false;
+                    }
+                }
+                catch (ScedaException)
+                {
+                    passed = false;
+                }
+                if (!passed)
+                {
+                    failedCount++;
+                }
+                checkedCount++;
+            }
+            Console.WriteLine("Known answer vectors: " + checkedCount + " checked, " + failedCount + " failed");
+            return failedCount == 0;
+        }
+    }
+}
@@ -101,6 +101,11 @@ namespace Test
 
         static void Main(string[] args)
         {
+            if (args.Length == 2 && args[0] == "--kat")
+            {
+                Environment.Exit(KnownAnswers.Check(args[1]) ? 0 : 1);
+            }
+
             Console.WindowWidth = 80;
             Console.Title = "SmallChat - by Valentino Giudice";
 
@@ -0,0 +1,252 @@
+/*
+	Copyright (C) 2015 - Code written 100% by Valentino Giudice
+	E-mail: valentino.giudice96@gmail.com
+	Website: http://valentinogiudice.altervista.org/
+	Twitter: http://twitter.com/aspie96
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+	EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+	(This work is also licensed under the GNU General Public License as published by the Free Software Foundation, either version 2 of the License, or, at your option, any later version).
+*/
+
+/*
+	Benchmarks the SCEDA primitives and checks them against the known answer vectors shared with the C# implementation.
+
+	Usage:	bench [vectors]            checks the vectors (if given) and then runs the benchmarks
+			bench --generate vectors   writes new vectors using this implementation
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include "sceda.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0ULL
+#endif
+
+#define BENCH_MAX 4096
+
+const int benchSizes[] = {16, 64, 256, 1024, 4096};
+const int digestVectorSizes[] = {0, 1, 3, 14, 15, 16, 17, 31, 32, 33, 48, 49, 63, 64, 65, 100, 255, 256, 257, 1000, 4096};
+const int scedaVectorSizes[] = {0, 1, 15, 16, 17, 31, 32, 33, 100, 255, 1000, 4000};
+
+void bench_fill(unsigned char *output, int length, unsigned int seed) {
+	int i;
+
+	for(i = 0; i < length; i++) {
+		seed = seed * 1103515245 + 12345;
+		output[i] = seed >> 16;
+	}
+}
+
+void bench_write_hex(FILE *file, const unsigned char *data, int length) {
+	int i;
+
+	if(!length) {
+		fputc('-', file);
+	}
+	for(i = 0; i < length; i++) {
+		fprintf(file, "%02x", data[i]);
+	}
+}
+
+int bench_read_hex(const char *text, unsigned char *output, int maxLength) {
+	int length;
+	unsigned int byte;
+
+	if(!strcmp(text, "-")) {
+		return 0;
+	}
+	length = 0;
+	while(text[0] && text[1] && length < maxLength && sscanf(text, "%2x", &byte) == 1) {
+		output[length++] = byte;
+		text += 2;
+	}
+	return *text ? -1 : length;
+}
+
+int bench_generate(const char *path) {
+	FILE *file;
+	unsigned char input[BENCH_MAX], output[BENCH_MAX + 32], key[16], iv[8];
+	int i, length;
+
+	if(!(file = fopen(path, "w"))) {
+		perror(path);
+		return 1;
+	}
+	fprintf(file, "# SCEDA known answer vectors, generated by the C implementation (C/bench.c) and checked by both implementations.\n");
+	fprintf(file, "# digest <input> <output>\n# decrypt <key> <iv> <encrypted message> <decrypted message>\n# Binary data is hexadecimal, \"-\" stands for no data.\n");
+	for(i = 0; i < (int)(sizeof(digestVectorSizes) / sizeof(int)); i++) {
+		length = digestVectorSizes[i];
+		bench_fill(input, length, length);
+		sceda_digest(output, input, length);
+		fprintf(file, "digest ");
+		bench_write_hex(file, input, length);
+		fprintf(file, " ");
+		bench_write_hex(file, output, 16);
+		fprintf(file, "\n");
+	}
+	for(i = 0; i < (int)(sizeof(scedaVectorSizes) / sizeof(int)); i++) {
+		length = scedaVectorSizes[i];
+		bench_fill(input, length, 7 * length + 1);
+		sceda_generate_key(key);
+		sceda_generate_iv(iv);
+		fprintf(file, "decrypt ");
+		bench_write_hex(file, key, 16);
+		fprintf(file, " ");
+		bench_write_hex(file, iv, 8);
+		fprintf(file, " ");
+		bench_write_hex(file, output, sceda_encrypt(output, input, length, key, iv));
+		fprintf(file, " ");
+		bench_write_hex(file, input, length);
+		fprintf(file, "\n");
+	}
+
+	fclose(file);
+	return 0;
+}
+
+int bench_check(const char *path) {
+	FILE *file;
+	static char line[6 * BENCH_MAX], kind[16], fields[4][2 * BENCH_MAX + 72];
+	unsigned char a[BENCH_MAX + 32], b[BENCH_MAX + 32], c[BENCH_MAX + 32], output[BENCH_MAX + 32];
+	int lengths[4], n, lanes, checked, failed, i;
+	SCedaKeyCtx ctx;
+
+	if(!(file = fopen(path, "r"))) {
+		perror(path);
+		return 1;
+	}
+	checked = 0;
+	failed = 0;
+	while(fgets(line, sizeof(line), file)) {
+		if(line[0] == '#' || line[0] == '\n') {
+			continue;
+		}
+		n = sscanf(line, "%15s %s %s %s %s", kind, fields[0], fields[1], fields[2], fields[3]);
+		for(i = 0; i < n - 1; i++) {
+			lengths[i] = bench_read_hex(fields[i], i ? (i == 1 ? b : (i == 2 ? c : output)) : a, BENCH_MAX + 32);
+		}
+		/* The vectors are checked with the scalar code and with the vectorized one. */
+		for(lanes = 1; lanes <= 8; lanes *= 2) {
+			sceda_digest_simd_lanes(lanes);
+			if(!strcmp(kind, "digest") && n == 3) {
+				sceda_digest(c, a, lengths[0]);
+				failed += memcmp(c, b, 16) != 0;
+			} else if(!strcmp(kind, "decrypt") && n == 5) {
+				sceda_key_ctx_init(&ctx, a);
+				memcpy(b + 8, c, lengths[2]);
+				failed += sceda_decrypt_inplace(b + 8, lengths[2], &ctx, b) != lengths[3] || memcmp(b + 8, output, lengths[3]);
+			} else {
+				fprintf(stderr, "Malformed vector: %s", line);
+				failed++;
+				break;
+			}
+			checked++;
+		}
+	}
+	sceda_digest_simd_lanes(0);
+
+	fclose(file);
+	printf("Known answer vectors: %d checked, %d failed\n", checked, failed);
+	return failed != 0;
+}
+
+double bench_seconds(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void bench_report(const char *name, int size, int iterations, double seconds, unsigned long long cycles) {
+	printf("%-24s %6d B %12.0f ops/s %10.2f MB/s", name, size, iterations / seconds, (double)size * iterations / seconds / 1e6);
+	if(cycles) {
+		printf(" %10.1f cycles/B", (double)cycles / ((double)size * iterations));
+	}
+	printf("\n");
+}
+
+#define BENCH(name, size, body) do { \
+	int iterations, iteration; \
+	double start; \
+	unsigned long long cycles; \
+	iterations = 1 + (1 << 22) / (size); \
+	start = bench_seconds(); \
+	cycles = BENCH_CYCLES(); \
+	for(iteration = 0; iteration < iterations; iteration++) { \
+		body; \
+	} \
+	cycles = BENCH_CYCLES() - cycles; \
+	bench_report(name, size, iterations, bench_seconds() - start, cycles); \
+} while(0)
+
+void bench_run(void) {
+	static unsigned char input[SCEDA_BATCH][BENCH_MAX], output[SCEDA_BATCH][BENCH_MAX + 32];
+	unsigned char key[16], iv[8], *outputs[SCEDA_BATCH];
+	const unsigned char *inputs[SCEDA_BATCH], *ivs[SCEDA_BATCH];
+	int lengths[SCEDA_BATCH], i, j, size, lanes;
+	char name[32];
+	SCedaKeyCtx ctx;
+
+	sceda_generate_key(key);
+	sceda_generate_iv(iv);
+	sceda_key_ctx_init(&ctx, key);
+	for(i = 0; i < SCEDA_BATCH; i++) {
+		bench_fill(input[i], BENCH_MAX, i);
+		inputs[i] = input[i];
+		outputs[i] = output[i];
+		ivs[i] = iv;
+	}
+	for(lanes = 1; lanes <= 8; lanes *= 2) {
+		if(sceda_digest_simd_lanes(lanes) != lanes) {
+			continue;
+		}
+		sprintf(name, "digest_func x%d", lanes);
+		BENCH(name, 16 * 64, sceda_digest_func_multi(output[0], input[0], 64));
+	}
+	sceda_digest_simd_lanes(0);
+	for(i = 0; i < (int)(sizeof(benchSizes) / sizeof(int)); i++) {
+		size = benchSizes[i];
+		BENCH("sceda_digest", size, sceda_digest(output[0], input[0], size));
+		BENCH("sceda_encrypt_ctx", size, sceda_encrypt_ctx(output[0], input[0], size, &ctx, iv));
+		memcpy(output[1], output[0], encrypted_length(size));
+		BENCH("sceda_decrypt_inplace", size, memcpy(output[0], output[1], encrypted_length(size)); sceda_decrypt_inplace(output[0], encrypted_length(size), &ctx, iv));
+		for(j = 0; j < SCEDA_BATCH; j++) {
+			lengths[j] = size;
+		}
+		sprintf(name, "sceda_encrypt_batch x%d", SCEDA_BATCH);
+		BENCH(name, size * SCEDA_BATCH, sceda_encrypt_batch(outputs, inputs, lengths, SCEDA_BATCH, &ctx, ivs));
+	}
+}
+
+int main(int argc, char **argv) {
+	if(argc == 3 && !strcmp(argv[1], "--generate")) {
+		return bench_generate(argv[2]);
+	}
+	if(argc == 2 && bench_check(argv[1])) {
+		return 1;
+	}
+	bench_run();
+	return 0;
+}
@@ -0,0 +1,162 @@
+/*
+	Copyright (C) 2015 - Code written 100% by Valentino Giudice
+	E-mail: valentino.giudice96@gmail.com
+	Website: http://valentinogiudice.altervista.org/
+	Twitter: http://twitter.com/aspie96
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+	EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+	(This work is also licensed under the GNU General Public License as published by the Free Software Foundation, either version 2 of the License, or, at your option, any later version).
+*/
+
+#include "csprng.h"
+#include <fcntl.h>
+#include <pthread.h>	/* -lpthread */
+#include <time.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+
+#define CSPRNG_BLOCKS 16
+
+#define ROTL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+#define QR(a, b, c, d)	(a += b, d ^= a, d = ROTL(d, 16), c += d, b ^= c, b = ROTL(b, 12), a += b, d ^= a, d = ROTL(d, 8), c += d, b ^= c, b = ROTL(b, 7))
+
+/**
+ * The state of the generator of a thread.
+ */
+struct CsprngState {
+	unsigned int key[8];
+	unsigned char buffer[64 * CSPRNG_BLOCKS];
+	int available;
+	unsigned int generation;
+};
+
+__thread struct CsprngState csprngState;
+
+/**
+ * Incremented in the child process after every fork, so that the child does not repeat the outputs of its parent.
+ */
+unsigned int csprngGeneration = 1;
+pthread_once_t csprngOnce = PTHREAD_ONCE_INIT;
+
+void csprng_on_fork(void) {
+	csprngGeneration++;
+}
+
+void csprng_register_fork_handler(void) {
+	pthread_atfork(0, 0, csprng_on_fork);
+}
+
+void csprng_chacha20_block(unsigned char *output, const unsigned int *key, unsigned int counter) {
+	unsigned int input[16], x[16];
+	int i;
+
+	input[0] = 0x61707865;
+	input[1] = 0x3320646e;
+	input[2] = 0x79622d32;
+	input[3] = 0x6b206574;
+	memcpy(input + 4, key, 32);
+	input[12] = counter;
+	input[13] = 0;
+	input[14] = 0;
+	input[15] = 0;
+	memcpy(x, input, 64);
+	for(i = 0; i < 10; i++) {
+		QR(x[0], x[4], x[8], x[12]);
+		QR(x[1], x[5], x[9], x[13]);
+		QR(x[2], x[6], x[10], x[14]);
+		QR(x[3], x[7], x[11], x[15]);
+		QR(x[0], x[5], x[10], x[15]);
+		QR(x[1], x[6], x[11], x[12]);
+		QR(x[2], x[7], x[8], x[13]);
+		QR(x[3], x[4], x[9], x[14]);
+	}
+	for(i = 0; i < 16; i++) {
+		x[i] += input[i];
+		output[4 * i] = x[i];
+		output[4 * i + 1] = x[i] >> 8;
+		output[4 * i + 2] = x[i] >> 16;
+		output[4 * i + 3] = x[i] >> 24;
+	}
+}
+
+void csprng_seed(struct CsprngState *state) {
+	unsigned char *pt;
+	int done, result, fd;
+
+	pt = (unsigned char*)state->key;
+	done = 0;
+#ifdef __linux__
+	while(done < 32 && (result = getrandom(pt + done, 32 - done, 0)) > 0) {
+		done += result;
+	}
+#endif
+	if(done < 32 && (fd = open("/dev/urandom", O_RDONLY)) >= 0) {
+		while(done < 32 && (result = read(fd, pt + done, 32 - done)) > 0) {
+			done += result;
+		}
+		close(fd);
+	}
+	if(done < 32) {
+		/* Last resort when no entropy source is available: better than a fixed key, but not secure. */
+		state->key[0] ^= (unsigned int)time(NULL);
+		state->key[1] ^= (unsigned int)clock();
+		state->key[2] ^= (unsigned int)getpid();
+		state->key[3] ^= (unsigned int)(size_t)state;
+	}
+	state->generation = csprngGeneration;
+	state->available = 0;
+}
+
+void csprng_refill(struct CsprngState *state) {
+	int i;
+
+	/* The first 32 bytes of every refill become the next key and are never handed out, so past outputs cannot be recovered from the state. */
+	for(i = 0; i < CSPRNG_BLOCKS; i++) {
+		csprng_chacha20_block(state->buffer + 64 * i, state->key, i);
+	}
+	memcpy(state->key, state->buffer, 32);
+	memset(state->buffer, 0, 32);
+	state->available = 64 * CSPRNG_BLOCKS - 32;
+}
+
+void csprng_fill(unsigned char *output, int length) {
+	struct CsprngState *state;
+	int count;
+
+	state = &csprngState;
+	if(state->generation != csprngGeneration) {
+		pthread_once(&csprngOnce, csprng_register_fork_handler);
+		csprng_seed(state);
+	}
+	while(length > 0) {
+		if(!state->available) {
+			csprng_refill(state);
+		}
+		count = length < state->available ? length : state->available;
+		memcpy(output, state->buffer + 64 * CSPRNG_BLOCKS - state->available, count);
+		memset(state->buffer + 64 * CSPRNG_BLOCKS - state->available, 0, count);
+		state->available -= count;
+		output += count;
+		length -= count;
+	}
+}
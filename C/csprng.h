@@ -0,0 +1,46 @@
+/*
+	Copyright (C) 2015 - Code written 100% by Valentino Giudice
+	E-mail: valentino.giudice96@gmail.com
+	Website: http://valentinogiudice.altervista.org/
+	Twitter: http://twitter.com/aspie96
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+	EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+	(This work is also licensed under the GNU General Public License as published by the Free Software Foundation, either version 2 of the License, or, at your option, any later version).
+*/
+
+#ifndef CSPRNG_H
+#define CSPRNG_H
+
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Fills a buffer with cryptographically secure random bytes.
+ *
+ * Every thread has its own ChaCha20 based generator, seeded from the operating system the first time it is used (and again after a fork), which produces random bytes in blocks and hands them out from a buffer. Therefore this function does not need any lock and it is cheap to call even for a few bytes at a time.
+ *
+ * @param   output  A pointer to the buffer to be filled.
+ * @param   length  The number of random bytes to be written into the buffer.
+ */
+void csprng_fill(unsigned char*, int);
+
+#endif // CSPRNG_H
@@ -29,6 +29,11 @@
 
 #include "digest.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCEDA_DIGEST_SIMD
+#endif
+
 #define T1(x)	(((~((x) >> 16)) << 16) | ((x) & 0xFFFF))
 #define T2(x)	(~(T1(x)))
 #define MV 8191
@@ -76,33 +81,290 @@ void sceda_digest_func(unsigned char *output, const unsigned char *original) {
 	memcpy(output, buffer, 16);
 }
 
-void sceda_digest(unsigned char *output, const unsigned char *original, int length) {
-	unsigned char *buffer, temp1[16], temp2[16];
-	int blockC, i, j;
-
-	blockC = (length + 17) / 16;
-	buffer = (unsigned char*)malloc(blockC * 16);
-	memcpy(buffer, original, length);
-	buffer[length] = length / 256;
-	buffer[length + 1] = length % 256;
-	for(i = length + 2; i < blockC * 16; i++) {
-		buffer[i] = 170;
+#ifdef SCEDA_DIGEST_SIMD
+/* The vectorized kernels keep every 32 bit word of a block in a separate register, one block per lane. At the end of each round the bytes of the buffer are rotated by one position, which is done with shifts instead of going back to bytes. */
+#define TRANSPOSE_SSE2(w, x, y, z) do { \
+	__m128i t0, t1, t2, t3; \
+	t0 = _mm_unpacklo_epi32(w, x); \
+	t1 = _mm_unpacklo_epi32(y, z); \
+	t2 = _mm_unpackhi_epi32(w, x); \
+	t3 = _mm_unpackhi_epi32(y, z); \
+	w = _mm_unpacklo_epi64(t0, t1); \
+	x = _mm_unpackhi_epi64(t0, t1); \
+	y = _mm_unpacklo_epi64(t2, t3); \
+	z = _mm_unpackhi_epi64(t2, t3); \
+} while(0)
+
+#define TRANSPOSE_AVX2(w, x, y, z) do { \
+	__m256i t0, t1, t2, t3; \
+	t0 = _mm256_unpacklo_epi32(w, x); \
+	t1 = _mm256_unpacklo_epi32(y, z); \
+	t2 = _mm256_unpackhi_epi32(w, x); \
+	t3 = _mm256_unpackhi_epi32(y, z); \
+	w = _mm256_unpacklo_epi64(t0, t1); \
+	x = _mm256_unpackhi_epi64(t0, t1); \
+	y = _mm256_unpacklo_epi64(t2, t3); \
+	z = _mm256_unpackhi_epi64(t2, t3); \
+} while(0)
+
+__attribute__((target("sse2"))) __m128i sceda_bswap_sse2(__m128i x) {
+	x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+__attribute__((target("sse2"))) __m128i sceda_mullo_sse2(__m128i x, __m128i y) {
+	__m128i even, odd;
+
+	even = _mm_mul_epu32(x, y);
+	odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+__attribute__((target("sse2"))) __m128i sceda_m_sse2(__m128i x, __m128i y) {
+	__m128i mv;
+
+	mv = _mm_set1_epi32(MV);
+	return _mm_xor_si128(sceda_mullo_sse2(x, y), sceda_mullo_sse2(_mm_add_epi32(x, mv), _mm_add_epi32(y, mv)));
+}
+
+__attribute__((target("sse2"))) void sceda_digest_func_sse2(unsigned char *output, const unsigned char *original) {
+	__m128i a, b, c, d, na, nb, nc, nd, t1, t2, low;
+	int i;
+
+	a = sceda_bswap_sse2(_mm_loadu_si128((const __m128i*)original));
+	b = sceda_bswap_sse2(_mm_loadu_si128((const __m128i*)(original + 16)));
+	c = sceda_bswap_sse2(_mm_loadu_si128((const __m128i*)(original + 32)));
+	d = sceda_bswap_sse2(_mm_loadu_si128((const __m128i*)(original + 48)));
+	TRANSPOSE_SSE2(a, b, c, d);
+	t1 = _mm_set1_epi32((int)0xFFFF0000);
+	t2 = _mm_set1_epi32(0x0000FFFF);
+	low = _mm_set1_epi32(0xFF);
+	for(i = 0; i < 4; i++) {
+		na = _mm_xor_si128(sceda_m_sse2(_mm_xor_si128(a, t1), _mm_xor_si128(b, t2)), _mm_xor_si128(b, _mm_xor_si128(c, d)));
+		nb = _mm_xor_si128(sceda_m_sse2(_mm_xor_si128(b, t1), _mm_xor_si128(c, t2)), _mm_xor_si128(a, na));
+		nc = _mm_xor_si128(sceda_m_sse2(_mm_xor_si128(c, t1), _mm_xor_si128(d, t2)), _mm_xor_si128(b, nb));
+		nd = _mm_xor_si128(sceda_m_sse2(_mm_xor_si128(d, t1), _mm_xor_si128(a, t2)), _mm_xor_si128(c, nc));
+		a = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(nd, low), 24), _mm_srli_epi32(na, 8));
+		b = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(na, low), 24), _mm_srli_epi32(nc, 8));
+		c = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(nc, low), 24), _mm_srli_epi32(nb, 8));
+		d = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(nb, low), 24), _mm_srli_epi32(nd, 8));
+	}
+	TRANSPOSE_SSE2(a, b, c, d);
+	_mm_storeu_si128((__m128i*)output, sceda_bswap_sse2(a));
+	_mm_storeu_si128((__m128i*)(output + 16), sceda_bswap_sse2(b));
+	_mm_storeu_si128((__m128i*)(output + 32), sceda_bswap_sse2(c));
+	_mm_storeu_si128((__m128i*)(output + 48), sceda_bswap_sse2(d));
+}
+
+__attribute__((target("avx2"))) __m256i sceda_m_avx2(__m256i x, __m256i y) {
+	__m256i mv;
+
+	mv = _mm256_set1_epi32(MV);
+	return _mm256_xor_si256(_mm256_mullo_epi32(x, y), _mm256_mullo_epi32(_mm256_add_epi32(x, mv), _mm256_add_epi32(y, mv)));
+}
+
+__attribute__((target("avx2"))) void sceda_digest_func_avx2(unsigned char *output, const unsigned char *original) {
+	__m256i a, b, c, d, na, nb, nc, nd, t1, t2, low, bswap;
+	int i;
+
+	/* Lane i holds block i in the low half and block i + 4 in the high half, so that the words can be transposed within each half. */
+	bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	a = _mm256_shuffle_epi8(_mm256_loadu2_m128i((const __m128i*)(original + 64), (const __m128i*)original), bswap);
+	b = _mm256_shuffle_epi8(_mm256_loadu2_m128i((const __m128i*)(original + 80), (const __m128i*)(original + 16)), bswap);
+	c = _mm256_shuffle_epi8(_mm256_loadu2_m128i((const __m128i*)(original + 96), (const __m128i*)(original + 32)), bswap);
+	d = _mm256_shuffle_epi8(_mm256_loadu2_m128i((const __m128i*)(original + 112), (const __m128i*)(original + 48)), bswap);
+	TRANSPOSE_AVX2(a, b, c, d);
+	t1 = _mm256_set1_epi32((int)0xFFFF0000);
+	t2 = _mm256_set1_epi32(0x0000FFFF);
+	low = _mm256_set1_epi32(0xFF);
+	for(i = 0; i < 4; i++) {
+		na = _mm256_xor_si256(sceda_m_avx2(_mm256_xor_si256(a, t1), _mm256_xor_si256(b, t2)), _mm256_xor_si256(b, _mm256_xor_si256(c, d)));
+		nb = _mm256_xor_si256(sceda_m_avx2(_mm256_xor_si256(b, t1), _mm256_xor_si256(c, t2)), _mm256_xor_si256(a, na));
+		nc = _mm256_xor_si256(sceda_m_avx2(_mm256_xor_si256(c, t1), _mm256_xor_si256(d, t2)), _mm256_xor_si256(b, nb));
+		nd = _mm256_xor_si256(sceda_m_avx2(_mm256_xor_si256(d, t1), _mm256_xor_si256(a, t2)), _mm256_xor_si256(c, nc));
+		a = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(nd, low), 24), _mm256_srli_epi32(na, 8));
+		b = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(na, low), 24), _mm256_srli_epi32(nc, 8));
+		c = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(nc, low), 24), _mm256_srli_epi32(nb, 8));
+		d = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(nb, low), 24), _mm256_srli_epi32(nd, 8));
 	}
-	for(i = 0; i < blockC; i++) {
-		sceda_digest_func(buffer + 16 * i, buffer + 16 * i);
+	TRANSPOSE_AVX2(a, b, c, d);
+	a = _mm256_shuffle_epi8(a, bswap);
+	b = _mm256_shuffle_epi8(b, bswap);
+	c = _mm256_shuffle_epi8(c, bswap);
+	d = _mm256_shuffle_epi8(d, bswap);
+	_mm256_storeu2_m128i((__m128i*)(output + 64), (__m128i*)output, a);
+	_mm256_storeu2_m128i((__m128i*)(output + 80), (__m128i*)(output + 16), b);
+	_mm256_storeu2_m128i((__m128i*)(output + 96), (__m128i*)(output + 32), c);
+	_mm256_storeu2_m128i((__m128i*)(output + 112), (__m128i*)(output + 48), d);
+}
+#endif // SCEDA_DIGEST_SIMD
+
+int sceda_digest_available_lanes(void) {
+#ifdef SCEDA_DIGEST_SIMD
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		return 8;
 	}
-	memcpy(output, buffer, 16);
-	for(i = 1; i < blockC; i++) {
-		memcpy(temp1, output, 8);
-		memcpy(temp1 + 8, buffer + 16 * i, 8);
-		memcpy(temp2, buffer + 16 * i + 8, 8);
-		memcpy(temp2 + 8, output + 8, 8);
-		sceda_digest_func(temp1, temp1);
-		sceda_digest_func(temp2, temp2);
-		for(j = 0; j < 16; j++) {
-			output[j] = temp1[j] ^ temp2[j];
+	if(__builtin_cpu_supports("sse2")) {
+		return 4;
+	}
+#endif
+	return 1;
+}
+
+/* Written once (or by an explicit override) and read by every thread that hashes, hence the atomic accesses. */
+int sceda_digest_lanes = 0;
+
+int sceda_digest_simd_lanes(int maxLanes) {
+	int lanes;
+
+	lanes = sceda_digest_available_lanes();
+	if(maxLanes > 0 && lanes > maxLanes) {
+		lanes = maxLanes >= 4 ? 4 : 1;
+	}
+	__atomic_store_n(&sceda_digest_lanes, lanes, __ATOMIC_RELAXED);
+	return lanes;
+}
+
+void sceda_digest_func_multi(unsigned char *output, const unsigned char *original, int count) {
+#ifdef SCEDA_DIGEST_SIMD
+	unsigned char padded[64];
+	int lanes;
+
+	lanes = __atomic_load_n(&sceda_digest_lanes, __ATOMIC_RELAXED);
+	if(!lanes) {
+		lanes = sceda_digest_simd_lanes(0);
+	}
+	if(lanes == 8) {
+		while(count >= 8) {
+			sceda_digest_func_avx2(output, original);
+			output += 128;
+			original += 128;
+			count -= 8;
+		}
+	}
+	if(lanes >= 4) {
+		while(count >= 4) {
+			sceda_digest_func_sse2(output, original);
+			output += 64;
+			original += 64;
+			count -= 4;
 		}
+		/* Filling a partial vector is still cheaper than running three lanes one by one (but not two). */
+		if(count == 3) {
+			memcpy(padded, original, 16 * count);
+			memset(padded + 16 * count, 0, 64 - 16 * count);
+			sceda_digest_func_sse2(padded, padded);
+			memcpy(output, padded, 16 * count);
+			return;
+		}
+	}
+#endif
+	while(count-- > 0) {
+		sceda_digest_func(output, original);
+		output += 16;
+		original += 16;
 	}
+}
+
+void sceda_digest_chain(unsigned char *state, const unsigned char *compressed) {
+	sceda_digest_chain_multi(state, compressed, 0, 1);
+}
+
+void sceda_digest_chain_multi(unsigned char *states, const unsigned char *compressed, int stride, int count) {
+	unsigned char temp[512];
+	int done, n, i, j;
+
+	for(done = 0; done < count; done += n) {
+		n = count - done;
+		if(n > 16) {
+			n = 16;
+		}
+		for(i = 0; i < n; i++) {
+			memcpy(temp + 32 * i, states + 16 * (done + i), 8);
+			memcpy(temp + 32 * i + 8, compressed + stride * (done + i), 8);
+			memcpy(temp + 32 * i + 16, compressed + stride * (done + i) + 8, 8);
+			memcpy(temp + 32 * i + 24, states + 16 * (done + i) + 8, 8);
+		}
+		sceda_digest_func_multi(temp, temp, 2 * n);
+		for(i = 0; i < n; i++) {
+			for(j = 0; j < 16; j++) {
+				states[16 * (done + i) + j] = temp[32 * i + j] ^ temp[32 * i + 16 + j];
+			}
+		}
+	}
+}
+
+void sceda_digest_init(ScedaDigestState *digest) {
+	digest->bufferLength = 0;
+	digest->length = 0;
+}
+
+void sceda_digest_absorb(ScedaDigestState *digest, const unsigned char *compressed) {
+	digest->length += 16;
+	if(digest->length == 16) {
+		memcpy(digest->state, compressed, 16);
+	} else {
+		sceda_digest_chain(digest->state, compressed);
+	}
+}
+
+void sceda_digest_update(ScedaDigestState *digest, const unsigned char *input, int length) {
+	unsigned char compressed[128];
+	int count, i;
+
+	while(length > 0) {
+		/* Whole blocks are independent of each other until they are chained, so they are compressed several at a time. */
+		if(!digest->bufferLength && length >= 32) {
+			count = length / 16;
+			if(count > 8) {
+				count = 8;
+			}
+			sceda_digest_func_multi(compressed, input, count);
+			for(i = 0; i < count; i++) {
+				sceda_digest_absorb(digest, compressed + 16 * i);
+			}
+			input += 16 * count;
+			length -= 16 * count;
+			continue;
+		}
+		count = 16 - digest->bufferLength;
+		if(count > length) {
+			count = length;
+		}
+		memcpy(digest->buffer + digest->bufferLength, input, count);
+		digest->bufferLength += count;
+		input += count;
+		length -= count;
+		if(digest->bufferLength == 16) {
+			sceda_digest_func(compressed, digest->buffer);
+			sceda_digest_absorb(digest, compressed);
+			digest->bufferLength = 0;
+		}
+	}
+}
+
+void sceda_digest_final(ScedaDigestState *digest, unsigned char *output) {
+	unsigned char trailer[2], compressed[16];
+	int length;
+
+	length = digest->length + digest->bufferLength;
+	trailer[0] = length / 256;
+	trailer[1] = length % 256;
+	sceda_digest_update(digest, trailer, 2);
+	if(digest->bufferLength) {
+		memset(digest->buffer + digest->bufferLength, 170, 16 - digest->bufferLength);
+		sceda_digest_func(compressed, digest->buffer);
+		sceda_digest_absorb(digest, compressed);
+		digest->bufferLength = 0;
+	}
+	memcpy(output, digest->state, 16);
+}
+
+void sceda_digest(unsigned char *output, const unsigned char *original, int length) {
+	ScedaDigestState digest;
 
-	free(buffer);
+	sceda_digest_init(&digest);
+	sceda_digest_update(&digest, original, length);
+	sceda_digest_final(&digest, output);
 }
@@ -34,6 +34,28 @@
 #include <stdio.h>
 #include <stdlib.h> 
 
+/**
+ * Holds the state of an incremental ScedaDigest computation (see {@link sceda_digest_init}, {@link sceda_digest_update} and {@link sceda_digest_final}).
+ */
+struct ScedaDigestState {
+	/**
+	 * The running state, which becomes the output once every block has been mixed in.
+	 */
+	unsigned char state[16];
+
+	/**
+	 * The bytes of the block which is not complete yet.
+	 */
+	unsigned char buffer[16];
+	int bufferLength;
+
+	/**
+	 * The number of bytes of the complete blocks hashed so far.
+	 */
+	int length;
+};
+typedef struct ScedaDigestState ScedaDigestState;
+
 /**
  * Hashes data using the ScedaDigest algorithm.
  *
@@ -42,4 +64,71 @@
  */
 void sceda_digest(unsigned char *output, const unsigned char *input, int length);
 
+/**
+ * Initializes an instance of the {@link ScedaDigestState} structure to begin hashing a new message.
+ *
+ * @param   digest  A pointer to the instance to be initialized.
+ */
+void sceda_digest_init(ScedaDigestState*);
+
+/**
+ * Hashes a part of a message (the output is the same as if all the parts had been given to {@link sceda_digest} at once).
+ *
+ * @param   digest  A pointer to the state of the computation, initialized with {@link sceda_digest_init}.
+ * @param   input   A pointer to the part of the message to be hashed.
+ * @param   length  The length of the part of the message.
+ */
+void sceda_digest_update(ScedaDigestState*, const unsigned char*, int);
+
+/**
+ * Completes a ScedaDigest computation.
+ *
+ * @param   digest  A pointer to the state of the computation, which shall not be updated anymore.
+ * @param   output  A pointer to the buffer to be written the 16 bytes long output into.
+ */
+void sceda_digest_final(ScedaDigestState*, unsigned char*);
+
+/**
+ * Applies the compression function of ScedaDigest to a single block.
+ *
+ * @param   output      A pointer to the buffer to be written the 16 bytes long output into (it may be the same as {@code original}).
+ * @param   original    A pointer to the block to be compressed (it must be 16 bytes long).
+ */
+void sceda_digest_func(unsigned char*, const unsigned char*);
+
+/**
+ * Applies the compression function of ScedaDigest to several independent blocks at once, using the widest vector instructions supported by the processor (the output is the same as the one of {@link sceda_digest_func} for each block).
+ *
+ * @param   output      A pointer to the buffer to be written the outputs into (it may be the same as {@code original}).
+ * @param   original    A pointer to the blocks to be compressed, one after another.
+ * @param   count       The number of blocks to be compressed.
+ */
+void sceda_digest_func_multi(unsigned char*, const unsigned char*, int);
+
+/**
+ * Limits the number of blocks {@link sceda_digest_func_multi} compresses at once (this is mostly useful to compare the vectorized code with the scalar one, which is always available).
+ *
+ * @param   maxLanes    The maximum number of blocks to be compressed at once ({@code 1} to only use the scalar code or {@code 0} for no limit).
+ * @return  The number of blocks which will actually be compressed at once.
+ */
+int sceda_digest_simd_lanes(int);
+
+/**
+ * Mixes an already compressed block into the running state of ScedaDigest, as {@link sceda_digest} does for every block but the first one.
+ *
+ * @param   state       A pointer to the running state to be updated (it must be 16 bytes long).
+ * @param   compressed  A pointer to the output of {@link sceda_digest_func} for the block to be mixed in (it must be 16 bytes long).
+ */
+void sceda_digest_chain(unsigned char*, const unsigned char*);
+
+/**
+ * Mixes already compressed blocks into several independent running states of ScedaDigest at once (the output is the same as the one of {@link sceda_digest_chain} for each state).
+ *
+ * @param   states      A pointer to the running states to be updated, one after another (each of them must be 16 bytes long).
+ * @param   compressed  A pointer to the first compressed block to be mixed in (it must be 16 bytes long).
+ * @param   stride      The distance in bytes between the compressed blocks to be mixed into consecutive states (or {@code 0} to mix the same block into all of them).
+ * @param   count       The number of states to be updated.
+ */
+void sceda_digest_chain_multi(unsigned char*, const unsigned char*, int, int);
+
 #endif // DIGEST_H
@@ -29,36 +29,57 @@
 
 #include "encodings.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ENCODINGS_SIMD
+#endif
+
+/* Every known name is in the slot given by ENCODING_HASH (which is a perfect hash of the names in lowercase). */
+#define ENCODING_HASH(name, length) (((length) + 3 * tolower((unsigned char)(name)[(length) - 1]) + 5 * tolower((unsigned char)(name)[(length) - 2])) & 31)
+#define ENCODING_MAX_NAME 11
+
+/* The lengths are stored, so that a received name is only compared with the known one if they are equally long. */
+#define ENCODING_NAME(name, encoding) {name, sizeof(name) - 1, encoding}
+
+struct EncodingName {
+	const char *name;
+	int length;
+	KnownEncoding encoding;
+};
+
+static const struct EncodingName encodingNames[32] = {
+	[1] = ENCODING_NAME("utf-16be", ENCODING_UTF_16_BE),
+	[4] = ENCODING_NAME("csisolatin1", ENCODING_LATIN1),
+	[5] = ENCODING_NAME("cp819", ENCODING_LATIN1),
+	[6] = ENCODING_NAME("ibm819", ENCODING_LATIN1),
+	[10] = ENCODING_NAME("iso-ir-100", ENCODING_LATIN1),
+	[11] = ENCODING_NAME("utf-7", ENCODING_UTF_7),
+	[13] = ENCODING_NAME("ascii", ENCODING_ASCII),
+	[14] = ENCODING_NAME("utf-8", ENCODING_UTF_8),
+	[16] = ENCODING_NAME("us-ascii", ENCODING_ASCII),
+	[17] = ENCODING_NAME("l1", ENCODING_LATIN1),
+	[19] = ENCODING_NAME("utf-16le", ENCODING_UTF_16_LE),
+	[27] = ENCODING_NAME("utf-32", ENCODING_UTF_32),
+	[29] = ENCODING_NAME("utf-16", ENCODING_UTF_16_LE),
+	[30] = ENCODING_NAME("iso-8859-1", ENCODING_LATIN1),
+	[31] = ENCODING_NAME("latin1", ENCODING_LATIN1)
+};
+
 KnownEncoding get_encoding(const char *encoding) {
-	KnownEncoding retVal;
-	int i;
-	char *lower;
-
-	lower = (char*)malloc(strlen(encoding) + 1);
-	for(i = 0; i <= strlen(encoding); i++) {
-		lower[i] = tolower(encoding[i]);
-	}
-
-	if(!(strcmp(lower, "us-ascii") && strcmp(lower, "ascii"))) {
-		retVal = ENCODING_ASCII;
-	} else if(!strcmp(lower, "utf-7")) {
-		retVal = ENCODING_UTF_7;
-	} else if(!strcmp(lower, "utf-8")) {
-		retVal = ENCODING_UTF_8;
-	} else if(!(strcmp(lower, "utf-16") && strcmp(lower, "utf-16le"))) {
-		retVal = ENCODING_UTF_16_LE;
-	} else if(!strcmp(lower, "utf-16be")) {
-		retVal = ENCODING_UTF_16_BE;
-	} else if(!strcmp(lower, "utf-32")) {
-		retVal = ENCODING_UTF_32;
-	} else if(!(strcmp(lower, "cp819") && strcmp(lower, "csisolatin1") && strcmp(lower, "ibm819") && strcmp(lower, "iso-8859-1") && strcmp(lower, "iso-ir-100") && strcmp(lower, "l1") && strcmp(lower, "latin1"))) {
-		retVal = ENCODING_LATIN1;
-	} else {
-		retVal = ENCODING_UNKNOWN;
-	}
-
-	free(lower);
-	return retVal;
+	return get_encoding_n(encoding, strnlen(encoding, ENCODING_MAX_NAME + 1));
+}
+
+KnownEncoding get_encoding_n(const char *encoding, int length) {
+	const struct EncodingName *entry;
+
+	if(length < 2 || length > ENCODING_MAX_NAME) {
+		return ENCODING_UNKNOWN;
+	}
+	entry = encodingNames + ENCODING_HASH(encoding, length);
+	if(entry->length != length || strncasecmp(entry->name, encoding, length)) {
+		return ENCODING_UNKNOWN;
+	}
+	return entry->encoding;
 }
 
 int get_encoding_name(char *output, KnownEncoding encoding) {
@@ -99,59 +120,380 @@ int get_encoding_name(char *output, KnownEncoding encoding) {
 	return strlen(output);
 }
 
-int to_ascii(char *output, const unsigned char *original, KnownEncoding inputEncoding) {
+int encodings_simd = -1;
+
+int encodings_has_simd(void) {
+#ifdef ENCODINGS_SIMD
+	if(encodings_simd < 0) {
+		__builtin_cpu_init();
+		encodings_simd = __builtin_cpu_supports("sse2") != 0;
+	}
+	return encodings_simd;
+#else
+	return 0;
+#endif
+}
+
+#ifdef ENCODINGS_SIMD
+__attribute__((target("sse2"))) int ascii_prefix_sse2(const unsigned char *original, int length) {
 	int retVal;
-	const unsigned char *pt;
 
-	pt = original;
-	retVal = 0;
-	switch(inputEncoding) {
-		case ENCODING_UNKNOWN: {
-			retVal = -1;
+	for(retVal = 0; retVal + 16 <= length; retVal += 16) {
+		if(_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(original + retVal)))) {
 			break;
 		}
-		case ENCODING_ASCII: ENCODING_UTF_7: ENCODING_LATIN1: {
-			memcpy(output, original, strlen(original));
-			retVal = strlen(original);
+	}
+	return retVal;
+}
+
+__attribute__((target("sse2"))) int ascii_prefix_utf16_sse2(char *output, const unsigned char *original, int length, int bigEndian) {
+	__m128i units, high;
+	int retVal;
+
+	/* 8 code units at a time: if none of them is above 0x7F, they are packed into 8 ASCII bytes. */
+	high = _mm_set1_epi16((short)0xFF80);
+	for(retVal = 0; 2 * retVal + 16 <= length; retVal += 8) {
+		units = _mm_loadu_si128((const __m128i*)(original + 2 * retVal));
+		if(bigEndian) {
+			units = _mm_or_si128(_mm_slli_epi16(units, 8), _mm_srli_epi16(units, 8));
+		}
+		if(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(units, high), _mm_setzero_si128())) != 0xFFFF) {
 			break;
 		}
-		case ENCODING_UTF_8: {
-			while(*pt) {
-				if(*pt < 128) {
-					output[retVal++] = *pt;
-					pt++;
+		_mm_storel_epi64((__m128i*)(output + retVal), _mm_packus_epi16(units, units));
+	}
+	return retVal;
+}
+
+__attribute__((target("sse2"))) int ascii_prefix_utf32_sse2(char *output, const unsigned char *original, int length) {
+	__m128i first, second, high, packed;
+	int retVal;
+
+	high = _mm_set1_epi32((int)0xFFFFFF80);
+	for(retVal = 0; 4 * retVal + 32 <= length; retVal += 8) {
+		first = _mm_loadu_si128((const __m128i*)(original + 4 * retVal));
+		second = _mm_loadu_si128((const __m128i*)(original + 4 * retVal + 16));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(_mm_or_si128(first, second), high), _mm_setzero_si128())) != 0xFFFF) {
+			break;
+		}
+		/* The values fit in 7 bits, so packing them as signed integers twice is exact. */
+		packed = _mm_packs_epi32(first, second);
+		_mm_storel_epi64((__m128i*)(output + retVal), _mm_packus_epi16(packed, packed));
+	}
+	return retVal;
+}
+#endif
+
+int ascii_prefix(const unsigned char *original, int length) {
+	int retVal;
+
+	retVal = 0;
+#ifdef ENCODINGS_SIMD
+	if(encodings_has_simd()) {
+		retVal = ascii_prefix_sse2(original, length);
+	}
+#endif
+	while(retVal < length && original[retVal] < 0x80) {
+		retVal++;
+	}
+	return retVal;
+}
+
+int utf8_put(char *output, unsigned int codePoint) {
+	if(codePoint < 0x80) {
+		output[0] = codePoint;
+		return 1;
+	}
+	if(codePoint < 0x800) {
+		output[0] = 0xC0 | (codePoint >> 6);
+		output[1] = 0x80 | (codePoint & 0x3F);
+		return 2;
+	}
+	if(codePoint < 0x10000) {
+		output[0] = 0xE0 | (codePoint >> 12);
+		output[1] = 0x80 | ((codePoint >> 6) & 0x3F);
+		output[2] = 0x80 | (codePoint & 0x3F);
+		return 3;
+	}
+	output[0] = 0xF0 | (codePoint >> 18);
+	output[1] = 0x80 | ((codePoint >> 12) & 0x3F);
+	output[2] = 0x80 | ((codePoint >> 6) & 0x3F);
+	output[3] = 0x80 | (codePoint & 0x3F);
+	return 4;
+}
+
+int utf8_validate(const unsigned char *original, int length) {
+	int i, count;
+	unsigned int codePoint, minimum;
+
+	i = 0;
+	while(i < length) {
+		i += ascii_prefix(original + i, length - i);
+		if(i >= length) {
+			break;
+		}
+		if(original[i] >= 0xC2 && original[i] <= 0xDF) {
+			count = 1;
+			minimum = 0x80;
+			codePoint = original[i] & 0x1F;
+		} else if(original[i] >= 0xE0 && original[i] <= 0xEF) {
+			count = 2;
+			minimum = 0x800;
+			codePoint = original[i] & 0x0F;
+		} else if(original[i] >= 0xF0 && original[i] <= 0xF4) {
+			count = 3;
+			minimum = 0x10000;
+			codePoint = original[i] & 0x07;
+		} else {
+			return 0;
+		}
+		if(length - i <= count) {
+			return 0;
+		}
+		while(count--) {
+			if((original[++i] & 0xC0) != 0x80) {
+				return 0;
+			}
+			codePoint = (codePoint << 6) | (original[i] & 0x3F);
+		}
+		i++;
+		/* Overlong sequences, surrogates and code points above U+10FFFF are rejected. */
+		if(codePoint < minimum || (codePoint >= 0xD800 && codePoint <= 0xDFFF) || codePoint > 0x10FFFF) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int utf16_to_utf8(char *output, const unsigned char *original, int length, int bigEndian) {
+	int retVal, i;
+	unsigned int unit, next;
+
+	if(length % 2) {
+		return -1;
+	}
+	retVal = 0;
+	i = 0;
+	while(i < length) {
+#ifdef ENCODINGS_SIMD
+		if(encodings_has_simd()) {
+			unit = ascii_prefix_utf16_sse2(output + retVal, original + i, length - i, bigEndian);
+			retVal += unit;
+			i += 2 * unit;
+			if(i >= length) {
+				break;
+			}
+		}
+#endif
+		unit = bigEndian ? (original[i] << 8) | original[i + 1] : original[i] | (original[i + 1] << 8);
+		i += 2;
+		if(unit >= 0xD800 && unit <= 0xDBFF) {
+			if(i >= length) {
+				return -1;
+			}
+			next = bigEndian ? (original[i] << 8) | original[i + 1] : original[i] | (original[i + 1] << 8);
+			if(next < 0xDC00 || next > 0xDFFF) {
+				return -1;
+			}
+			i += 2;
+			unit = 0x10000 + ((unit - 0xD800) << 10) + (next - 0xDC00);
+		} else if(unit >= 0xDC00 && unit <= 0xDFFF) {
+			return -1;
+		}
+		retVal += utf8_put(output + retVal, unit);
+	}
+	return retVal;
+}
+
+int utf32_to_utf8(char *output, const unsigned char *original, int length) {
+	int retVal, i;
+	unsigned int codePoint;
+
+	if(length % 4) {
+		return -1;
+	}
+	retVal = 0;
+	i = 0;
+	while(i < length) {
+#ifdef ENCODINGS_SIMD
+		if(encodings_has_simd()) {
+			codePoint = ascii_prefix_utf32_sse2(output + retVal, original + i, length - i);
+			retVal += codePoint;
+			i += 4 * codePoint;
+			if(i >= length) {
+				break;
+			}
+		}
+#endif
+		codePoint = original[i] | (original[i + 1] << 8) | (original[i + 2] << 16) | ((unsigned int)original[i + 3] << 24);
+		i += 4;
+		if((codePoint >= 0xD800 && codePoint <= 0xDFFF) || codePoint > 0x10FFFF) {
+			return -1;
+		}
+		retVal += utf8_put(output + retVal, codePoint);
+	}
+	return retVal;
+}
+
+int latin1_to_utf8(char *output, const unsigned char *original, int length) {
+	int retVal, i, ascii;
+
+	retVal = 0;
+	i = 0;
+	while(i < length) {
+		ascii = ascii_prefix(original + i, length - i);
+		memcpy(output + retVal, original + i, ascii);
+		retVal += ascii;
+		i += ascii;
+		if(i < length) {
+			retVal += utf8_put(output + retVal, original[i++]);
+		}
+	}
+	return retVal;
+}
+
+int utf7_base64(unsigned char c) {
+	if(c >= 'A' && c <= 'Z') {
+		return c - 'A';
+	}
+	if(c >= 'a' && c <= 'z') {
+		return c - 'a' + 26;
+	}
+	if(c >= '0' && c <= '9') {
+		return c - '0' + 52;
+	}
+	if(c == '+') {
+		return 62;
+	}
+	if(c == '/') {
+		return 63;
+	}
+	return -1;
+}
+
+int utf7_to_utf8(char *output, const unsigned char *original, int length) {
+	int retVal, i, value, bits;
+	unsigned int buffer, unit, high;
+
+	retVal = 0;
+	i = 0;
+	while(i < length) {
+		if(original[i] >= 0x80) {
+			return -1;
+		}
+		if(original[i] != '+') {
+			output[retVal++] = original[i++];
+			continue;
+		}
+		i++;
+		if(i < length && original[i] == '-') {
+			output[retVal++] = '+';
+			i++;
+			continue;
+		}
+		/* A base64 run encodes UTF-16 big endian code units (and it ends with the first character which is not base64, which is dropped if it is a minus sign). */
+		buffer = 0;
+		bits = 0;
+		high = 0;
+		while(i < length && (value = utf7_base64(original[i])) >= 0) {
+			buffer = (buffer << 6) | value;
+			bits += 6;
+			i++;
+			if(bits >= 16) {
+				bits -= 16;
+				unit = (buffer >> bits) & 0xFFFF;
+				if(high) {
+					if(unit < 0xDC00 || unit > 0xDFFF) {
+						return -1;
+					}
+					retVal += utf8_put(output + retVal, 0x10000 + ((high - 0xD800) << 10) + (unit - 0xDC00));
+					high = 0;
+				} else if(unit >= 0xD800 && unit <= 0xDBFF) {
+					high = unit;
+				} else if(unit >= 0xDC00 && unit <= 0xDFFF) {
+					return -1;
 				} else {
-					pt += 2;
+					retVal += utf8_put(output + retVal, unit);
 				}
 			}
-			output[retVal] = 0;
 		}
-		case ENCODING_UTF_16_LE: {
-			while(*pt || *(pt+1)) {
-				output[retVal++] = *pt;
-				pt += 2;
+		if(high || bits >= 6 || (buffer & ((1 << bits) - 1))) {
+			return -1;
+		}
+		if(i < length && original[i] == '-') {
+			i++;
+		}
+	}
+	return retVal;
+}
+
+int to_utf8(char *output, const unsigned char *original, int length, KnownEncoding encoding, const char **result) {
+	int retVal;
+
+	*result = output;
+	switch(encoding) {
+		case ENCODING_ASCII: {
+			if(ascii_prefix(original, length) != length) {
+				return -1;
+			}
+			*result = (const char*)original;
+			return length;
+		}
+		case ENCODING_UTF_8: {
+			if(!utf8_validate(original, length)) {
+				return -1;
 			}
-			output[retVal] = 0;
+			*result = (const char*)original;
+			return length;
+		}
+		case ENCODING_UTF_7: {
+			retVal = utf7_to_utf8(output, original, length);
+			break;
+		}
+		case ENCODING_UTF_16_LE: {
+			retVal = utf16_to_utf8(output, original, length, 0);
 			break;
 		}
 		case ENCODING_UTF_16_BE: {
-			pt++;
-			while(*(pt-1) || *pt) {
-				output[retVal++] = *pt;
-				pt += 2;
-			}
-			output[retVal] = 0;
+			retVal = utf16_to_utf8(output, original, length, 1);
 			break;
 		}
 		case ENCODING_UTF_32: {
-			while(*pt || *(pt+1) || *(pt+2) || *(pt+3)) {
-				output[retVal++] = *pt;
-				pt += 4;
-			}
-			output[retVal] = 0;
+			retVal = utf32_to_utf8(output, original, length);
+			break;
+		}
+		case ENCODING_LATIN1: {
+			retVal = latin1_to_utf8(output, original, length);
+			break;
+		}
+		default: {
+			retVal = -1;
 			break;
 		}
 	}
 
 	return retVal;
 }
+
+int to_ascii(char *output, const unsigned char *original, KnownEncoding inputEncoding) {
+	int length, unit, retVal, i;
+	const char *utf8;
+	char *buffer;
+
+	/* The length of the original string is given by its terminator, which is as long as a code unit of the encoding. */
+	unit = inputEncoding == ENCODING_UTF_32 ? 4 : (inputEncoding == ENCODING_UTF_16_LE || inputEncoding == ENCODING_UTF_16_BE ? 2 : 1);
+	for(length = 0; memcmp(original + length, "\0\0\0\0", unit); length += unit);
+	buffer = (char*)malloc(2 * length + 1);
+	length = to_utf8(buffer, original, length, inputEncoding, &utf8);
+	retVal = 0;
+	for(i = 0; i < length; i++) {
+		/* Every character which is not ASCII is replaced by a question mark (only the first byte of its UTF-8 sequence is not a continuation byte). */
+		if(((unsigned char)utf8[i] & 0xC0) != 0x80) {
+			output[retVal++] = (unsigned char)utf8[i] < 0x80 ? utf8[i] : '?';
+		}
+	}
+	output[retVal] = 0;
+	free(buffer);
+
+	return length < 0 ? -1 : retVal;
+}
@@ -33,6 +33,7 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 /**
  * Specify a character encoding used by the SmallChat protocol.
@@ -52,6 +53,11 @@ enum KnownEncoding {
 };
 typedef enum KnownEncoding KnownEncoding;
 
+/**
+ * The number of options of the {@link KnownEncoding} enumerator (including {@link ENCODING_UNKNOWN}).
+ */
+#define ENCODINGS_COUNT (ENCODING_LATIN1 + 1)
+
 /**
  * Converts the name of a character encoding into an option of the {@link KnownEncoding} enumerator.
  *
@@ -60,6 +66,14 @@ typedef enum KnownEncoding KnownEncoding;
  */
 KnownEncoding get_encoding(const char*);
 
+/**
+ * Converts the name of a character encoding, which is not necessarily null terminated, into an option of the {@link KnownEncoding} enumerator (without allocating anything).
+ * @param   encoding    The name of the character encoding to be converted (it is not case sensitive).
+ * @param   length      The number of characters of the name.
+ * @return  The corresponding {@link KnownEncoding} option (or {@link ENCODING_UNKNOWN} if it is not known).
+ */
+KnownEncoding get_encoding_n(const char*, int);
+
 /**
  * Converts an option of the {@link KnownEncoding} enumerator into the name of its corresponding charset encoding.
  *
@@ -70,11 +84,25 @@ KnownEncoding get_encoding(const char*);
 int get_encoding_name(char*, KnownEncoding);
 
 /**
- * Converts a non ASCII string into an ASCII one (Warning: this type of conversion is not always possible and this function might not work as expected. If better alternative are available, then use them).
+ * Converts a string into UTF-8, validating it (overlong sequences, unpaired surrogates and code points above U+10FFFF are rejected).
+ * ASCII and UTF-8 strings are not copied: in that case the result points to the original string.
+ *
+ * @param	output      A buffer of at least {@code 2 * length} bytes, to be written the UTF-8 string into if a conversion is needed (the result is not null terminated).
+ * @param	original    A pointer to the binary representation of the string.
+ * @param	length      The length of the string in bytes (without any terminator).
+ * @param	encoding    The encoding of the original string.
+ * @param	result      A pointer to be set to the UTF-8 string (either {@code output} or {@code original}).
+ * @return  The length of the UTF-8 string in bytes or {@code -1} if the original string is not valid in its encoding.
+ */
+int to_utf8(char*, const unsigned char*, int, KnownEncoding, const char**);
+
+/**
+ * Converts a non ASCII string into an ASCII one (every character which is not ASCII is replaced by a question mark).
  *
- * @param	output          The buffer to be written the ASCII string into.
+ * @param	output          The buffer to be written the ASCII string into (as long as the original string in bytes, terminator included).
  * @param	original        A pointer to the binary representation of the non ASCII string (which must have a properly sized null terminator).
  * @param	inputEncoding   The encoding of the original string.
+ * @return  The length of the ASCII string or {@code -1} if the original string is not valid in its encoding.
  */
 int to_ascii(char*, const unsigned char*, KnownEncoding);
 
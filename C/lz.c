@@ -0,0 +1,178 @@
+/*
+	Copyright (C) 2015 - Code written 100% by Valentino Giudice
+	E-mail: valentino.giudice96@gmail.com
+	Website: http://valentinogiudice.altervista.org/
+	Twitter: http://twitter.com/aspie96
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+	EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+	(This work is also licensed under the GNU General Public License as published by the Free Software Foundation, either version 2 of the License, or, at your option, any later version).
+*/
+
+#include "lz.h"
+
+int lz_hash(const unsigned char *input) {
+	unsigned int value;
+
+	memcpy(&value, input, 4);
+	return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+unsigned char *lz_write_length(unsigned char *output, const unsigned char *end, int length) {
+	/* The part of a length which does not fit in the 4 bits of the token is written as a sequence of bytes (255 means that another byte follows). */
+	while(length >= 255) {
+		if(output >= end) {
+			return 0;
+		}
+		*(output++) = 255;
+		length -= 255;
+	}
+	if(output >= end) {
+		return 0;
+	}
+	*(output++) = length;
+	return output;
+}
+
+unsigned char *lz_write_sequence(unsigned char *output, const unsigned char *end, const unsigned char *literals, int literalLength, int offset, int matchLength) {
+	unsigned char *token;
+
+	if(output >= end) {
+		return 0;
+	}
+	token = output++;
+	*token = (literalLength < 15 ? literalLength : 15) << 4;
+	if(literalLength >= 15 && !(output = lz_write_length(output, end, literalLength - 15))) {
+		return 0;
+	}
+	if(end - output < literalLength) {
+		return 0;
+	}
+	memcpy(output, literals, literalLength);
+	output += literalLength;
+	if(!matchLength) {
+		return output;
+	}
+	if(end - output < 2) {
+		return 0;
+	}
+	*(output++) = offset;
+	*(output++) = offset >> 8;
+	matchLength -= LZ_MIN_MATCH;
+	*token |= matchLength < 15 ? matchLength : 15;
+	if(matchLength >= 15 && !(output = lz_write_length(output, end, matchLength - 15))) {
+		return 0;
+	}
+	return output;
+}
+
+int lz_compress(unsigned char *output, int capacity, const unsigned char *input, int length) {
+	int table[1 << LZ_HASH_BITS], position, anchor, candidate, matchLength, hash;
+	unsigned char *pt, *end;
+
+	memset(table, 0xFF, sizeof(table));
+	pt = output;
+	end = output + capacity;
+	anchor = 0;
+	position = 0;
+	while(position + LZ_MIN_MATCH <= length) {
+		hash = lz_hash(input + position);
+		candidate = table[hash];
+		table[hash] = position;
+		if(candidate < 0 || position - candidate > LZ_MAX_OFFSET || memcmp(input + candidate, input + position, LZ_MIN_MATCH)) {
+			position++;
+			continue;
+		}
+		matchLength = LZ_MIN_MATCH;
+		while(position + matchLength < length && input[candidate + matchLength] == input[position + matchLength]) {
+			matchLength++;
+		}
+		if(!(pt = lz_write_sequence(pt, end, input + anchor, position - anchor, position - candidate, matchLength))) {
+			return -1;
+		}
+		position += matchLength;
+		anchor = position;
+	}
+	if(!(pt = lz_write_sequence(pt, end, input + anchor, length - anchor, 0, 0))) {
+		return -1;
+	}
+	return pt - output;
+}
+
+int lz_read_length(const unsigned char **input, const unsigned char *end, int length) {
+	int byte;
+
+	do {
+		if(*input >= end) {
+			return -1;
+		}
+		byte = *((*input)++);
+		length += byte;
+		if(length < 0) {
+			return -1;
+		}
+	} while(byte == 255);
+	return length;
+}
+
+int lz_decompress(unsigned char *output, int capacity, const unsigned char *input, int length) {
+	const unsigned char *end, *match;
+	unsigned char *pt;
+	int token, literalLength, matchLength, offset;
+
+	pt = output;
+	end = input + length;
+	while(input < end) {
+		token = *(input++);
+		literalLength = token >> 4;
+		if(literalLength == 15 && (literalLength = lz_read_length(&input, end, literalLength)) < 0) {
+			return -1;
+		}
+		if(end - input < literalLength || output + capacity - pt < literalLength) {
+			return -1;
+		}
+		memcpy(pt, input, literalLength);
+		pt += literalLength;
+		input += literalLength;
+		if(input == end) {
+			break;
+		}
+		if(end - input < 2) {
+			return -1;
+		}
+		offset = input[0] | (input[1] << 8);
+		input += 2;
+		matchLength = token & 15;
+		if(matchLength == 15 && (matchLength = lz_read_length(&input, end, matchLength)) < 0) {
+			return -1;
+		}
+		matchLength += LZ_MIN_MATCH;
+		if(!offset || offset > pt - output || output + capacity - pt < matchLength) {
+			return -1;
+		}
+		/* The match may overlap with the bytes it produces, so it is copied byte by byte. */
+		match = pt - offset;
+		while(matchLength--) {
+			*(pt++) = *(match++);
+		}
+	}
+	return pt - output;
+}
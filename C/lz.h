@@ -0,0 +1,61 @@
+/*
+	Copyright (C) 2015 - Code written 100% by Valentino Giudice
+	E-mail: valentino.giudice96@gmail.com
+	Website: http://valentinogiudice.altervista.org/
+	Twitter: http://twitter.com/aspie96
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+	EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+	(This work is also licensed under the GNU General Public License as published by the Free Software Foundation, either version 2 of the License, or, at your option, any later version).
+*/
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+/**
+ * Compresses a buffer with a fast LZ77 codec (the format is a sequence of tokens, each of them followed by some literals and, except for the last one, by a 2 bytes offset and the length of a match with the data which has already been decompressed).
+ *
+ * @param   output      The buffer to be written the compressed data into.
+ * @param   capacity    The size of the output buffer.
+ * @param   input       A pointer to the data to be compressed.
+ * @param   length      The length of the data to be compressed.
+ * @return  The length of the compressed data (or {@code -1} if it does not fit in the output buffer).
+ */
+int lz_compress(unsigned char*, int, const unsigned char*, int);
+
+/**
+ * Decompresses a buffer compressed with {@link lz_compress}, checking that it is well formed.
+ *
+ * @param   output      The buffer to be written the decompressed data into.
+ * @param   capacity    The size of the output buffer.
+ * @param   input       A pointer to the compressed data.
+ * @param   length      The length of the compressed data.
+ * @return  The length of the decompressed data (or {@code -1} if the compressed data is malformed or if it does not fit in the output buffer).
+ */
+int lz_decompress(unsigned char*, int, const unsigned char*, int);
+
+#endif // LZ_H
@@ -69,7 +69,11 @@ int main(int argc, char **argv) {
 	myself->on_malformed_received = on_malformed;
 	myself->on_malformed_notification = on_malformed;
 	myself->on_conflict = on_conflict;
-	schost_start(myself);
+	if(schost_start(myself)) {
+		printf("The port %d is already in use.\n", SC_DEFAULT_PORT);
+		schost_destroy(myself);
+		return 1;
+	}
 	printf("Begin to chat now!\n\n");
 	for(;;) {
 		fgets(message, 100, stdin);
@@ -93,11 +97,14 @@ void on_leave(const SCInfo *info) {
 }
 
 void on_message(const SCInfo *info, const SCPdu *pdu) {
-	char *buffer = (char*)malloc(pdu->payloadLength + 4);
-	memcpy(buffer, pdu->payload, pdu->payloadLength);
-	bzero(buffer + pdu->payloadLength, 4);
-	to_ascii(buffer, buffer, pdu->encoding);
-	printf("%s: %s\n", info->nickname, buffer);
+	char *buffer = (char*)malloc(2 * pdu->payloadLength + 1);
+	const char *text;
+	int length;
+
+	if((length = to_utf8(buffer, pdu->payload, pdu->payloadLength, pdu->encoding, &text)) >= 0) {
+		printf("%s: %.*s\n", info->nickname, length, text);
+	}
+	free(buffer);
 }
 
 void on_malformed(const SCInfo *info, const char *pdu, int pduSize) {
@@ -27,8 +27,36 @@
 	(This work is also licensed under the GNU General Public License as published by the Free Software Foundation, either version 2 of the License, or, at your option, any later version).
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	/* sendmmsg, recvmmsg */
+#endif
 #include "sc.h"
 
+/* The listener handles the reliable channels, which are implemented along with the other sending functions. */
+int schost_reliable_tick(SCHost*, long long);
+void schost_receive_reliable(SCHost*, const SCInfo*, const SCPduView*);
+void schost_receive_ack(SCHost*, const SCInfo*, const SCPduView*);
+void schost_reliable_forget(SCHost*, struct sockaddr_in);
+
+void sc_write_uint32(unsigned char *output, unsigned int value) {
+	output[0] = value >> 24;
+	output[1] = value >> 16;
+	output[2] = value >> 8;
+	output[3] = value;
+}
+
+unsigned int sc_read_uint32(const unsigned char *input) {
+	return ((unsigned int)input[0] << 24) | ((unsigned int)input[1] << 16) | ((unsigned int)input[2] << 8) | (unsigned int)input[3];
+}
+
+long long sc_clock() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
 /* =============================== SCInfo =============================== */
 SCInfo *scinfo_create(struct sockaddr_in address, const char *nickname, const char *chatID) {
 	SCInfo *retVal;
@@ -36,12 +64,17 @@ SCInfo *scinfo_create(struct sockaddr_in address, const char *nickname, const ch
 	retVal->address = address;
 	retVal->nickname = strdup(nickname);
 	retVal->chatID = strdup(chatID);
+	retVal->capabilities = 0;
 
 	return retVal;
 }
 
 SCInfo *scinfo_dup(const SCInfo *original) {
-	return scinfo_create(original->address, original->nickname, original->chatID);
+	SCInfo *retVal;
+
+	retVal = scinfo_create(original->address, original->nickname, original->chatID);
+	retVal->capabilities = original->capabilities;
+	return retVal;
 }
 
 void scinfo_destroy(SCInfo *info) {
@@ -52,24 +85,48 @@ void scinfo_destroy(SCInfo *info) {
 
 
 /* =============================== SCPduType =============================== */
+/* The acronyms of the types of PDU, packed into integers so that they can be matched with a single comparison. */
+#define SC_TYPE_CODE(a, b, c) (((unsigned int)(a) << 16) | ((unsigned int)(b) << 8) | (unsigned int)(c))
+
 SCPduType scpdutype_get(const char *type) {
-	if(!strcmp(type, "HLO")) {
-		return PDU_HLO;
-	}
-	if(!strcmp(type, "ACK")) {
-		return PDU_ACK;
-	}
-	if(!strcmp(type, "LEV")) {
-		return PDU_LEV;
-	}
-	if(!strcmp(type, "MSG")) {
-		return PDU_MSG;
+	if(strnlen(type, 4) != 3) {
+		return PDU_UNKNOWN;
 	}
-	if(!strcmp(type, "BAD")) {
-		return PDU_BAD;
-	}
-	if(!strcmp(type, "CNF")) {
-		return PDU_CNF;
+	return scpdutype_get_n((const unsigned char*)type);
+}
+
+SCPduType scpdutype_get_n(const unsigned char *type) {
+	switch(SC_TYPE_CODE(type[0], type[1], type[2])) {
+		case SC_TYPE_CODE('H', 'L', 'O'): {
+			return PDU_HLO;
+		}
+		case SC_TYPE_CODE('A', 'C', 'K'): {
+			return PDU_ACK;
+		}
+		case SC_TYPE_CODE('L', 'E', 'V'): {
+			return PDU_LEV;
+		}
+		case SC_TYPE_CODE('M', 'S', 'G'): {
+			return PDU_MSG;
+		}
+		case SC_TYPE_CODE('B', 'A', 'D'): {
+			return PDU_BAD;
+		}
+		case SC_TYPE_CODE('C', 'N', 'F'): {
+			return PDU_CNF;
+		}
+		case SC_TYPE_CODE('F', 'R', 'G'): {
+			return PDU_FRG;
+		}
+		case SC_TYPE_CODE('R', 'M', 'S'): {
+			return PDU_RMS;
+		}
+		case SC_TYPE_CODE('S', 'A', 'K'): {
+			return PDU_SAK;
+		}
+		case SC_TYPE_CODE('M', 'B', 'R'): {
+			return PDU_MBR;
+		}
 	}
 	return PDU_UNKNOWN;
 }
@@ -100,6 +157,22 @@ int scpdutype_name(char *output, SCPduType type) {
 			memcpy(output, "CNF", 4);
 			break;
 		}
+		case PDU_FRG: {
+			memcpy(output, "FRG", 4);
+			break;
+		}
+		case PDU_RMS: {
+			memcpy(output, "RMS", 4);
+			break;
+		}
+		case PDU_SAK: {
+			memcpy(output, "SAK", 4);
+			break;
+		}
+		case PDU_MBR: {
+			memcpy(output, "MBR", 4);
+			break;
+		}
 		case PDU_UNKNOWN: {
 			return -1;
 		}
@@ -130,85 +203,218 @@ SCPdu *scpdu_dup(const SCPdu *original) {
 }
 
 SCPdu *scpdu_from_binary(const unsigned char *pdu, int length, const unsigned char *key) {
+	SCedaKeyCtx ctx;
+
+	sceda_key_ctx_init(&ctx, key);
+	return scpdu_from_binary_ctx(pdu, length, &ctx);
+}
+
+int scpdu_validate(const unsigned char *pdu, int length) {
+	const unsigned char *end;
+	int encryptedLength;
+
+	if(length < 2 + 1 + 8 + SC_MIN_ENCRYPTED || pdu[0] != 0 || pdu[1] != 1) {
+		return -1;
+	}
+	if(!(end = (const unsigned char*)memchr(pdu + 2, 0, length - 2 - 8 - SC_MIN_ENCRYPTED))) {
+		return -1;
+	}
+	encryptedLength = length - (end + 1 + 8 - pdu);
+	if(encryptedLength % 16) {
+		return -1;
+	}
+	return end + 1 - pdu;
+}
+
+SCPdu *scpdu_from_binary_ctx(const unsigned char *pdu, int length, const SCedaKeyCtx *ctx) {
 	SCPdu *retVal;
-	SCPduType type;
+	unsigned char buffer[SC_MAX_PDU], *scratch;
+
+	if(scpdu_validate(pdu, length) < 0) {
+		return 0;
+	}
+	scratch = length > SC_MAX_PDU ? (unsigned char*)malloc(length) : buffer;
+	retVal = scpdu_from_binary_buffered(pdu, length, ctx, scratch);
+	if(scratch != buffer) {
+		free(scratch);
+	}
+	return retVal;
+}
+
+SCPdu *scpdu_from_binary_buffered(const unsigned char *pdu, int length, const SCedaKeyCtx *ctx, unsigned char *scratch) {
+	SCPduView view;
+
+	if(!scpdu_view_from_binary(&view, pdu, length, ctx, scratch)) {
+		return 0;
+	}
+	return scpdu_view_to_owned(&view);
+}
+
+int scpdu_view_from_binary(SCPduView *view, const unsigned char *pdu, int length, const SCedaKeyCtx *ctx, unsigned char *scratch) {
+	int ivOffset;
+
+	if((ivOffset = scpdu_validate(pdu, length)) < 0) {
+		return 0;
+	}
+	return scpdu_view_from_validated(view, pdu, length, ivOffset, ctx, scratch);
+}
+
+int scpdu_view_from_validated(SCPduView *view, const unsigned char *pdu, int length, int ivOffset, const SCedaKeyCtx *ctx, unsigned char *scratch) {
 	int msgLen;
-	unsigned char *msg;
 	const unsigned char *pt, *iv;
-	char *temp;
-	KnownEncoding encoding;
 
-	pt = pdu;
-	if(*(pt++)!=0 || *(pt++)!=1) {
+	iv = pdu + ivOffset;
+	pt = iv + 8;
+	memcpy(scratch, pt, length - (pt - pdu));
+	msgLen = sceda_decrypt_inplace(scratch, length - (pt - pdu), ctx, iv);
+	return scpdu_view_from_decrypted(view, pdu, scratch, msgLen);
+}
+
+int scpdu_view_from_decrypted(SCPduView *view, const unsigned char *pdu, const unsigned char *scratch, int msgLen) {
+	int nameLen;
+	const unsigned char *pt, *end;
+
+	/* The type and the name of the encoding (with its terminator) must be inside the decrypted message. */
+	if(msgLen < 4 || !(end = (const unsigned char*)memchr(scratch + 3, 0, msgLen - 3))) {
 		return 0;
 	}
-	while(pt-pdu < length && *(pt++));
-	if(pt-pdu > length + 10) {
+	view->type = scpdutype_get_n(scratch);
+	if(view->type == PDU_UNKNOWN) {
 		return 0;
 	}
-	iv = pt;
-	pt += 8;
-	msg = (unsigned char*)malloc(length);
-	msgLen = sceda_decrypt(msg, pt, length - (pt - pdu), key, iv);
-	temp = (char*)malloc(4);
-	pt = msg;
-	memcpy(temp, pt, 3);
-	temp[3] = 0;
-	type = scpdutype_get(temp);
-	if(type == PDU_UNKNOWN) {
-		free(msg);
+	pt = scratch + 3;
+	nameLen = end - pt;
+	view->compressed = nameLen > 3 && !strncasecmp((const char*)end - 3, "+lz", 3);
+	view->encoding = get_encoding_n((const char*)pt, view->compressed ? nameLen - 3 : nameLen);
+	if(view->encoding == ENCODING_UNKNOWN) {
+		return 0;
+	}
+	pt += nameLen + 1;
+	view->chatID = (const char*)pdu + 2;
+	view->payload = pt;
+	view->payloadLength = msgLen - (pt - scratch);
+
+	return 1;
+}
+
+int scpdu_view_inflate(SCPduView *view, unsigned char *output, int capacity) {
+	unsigned int length;
+
+	if(!view->compressed) {
+		return 1;
+	}
+	if(view->payloadLength < 4 || (length = sc_read_uint32(view->payload)) > (unsigned int)capacity) {
 		return 0;
 	}
-	free(temp);
-	pt += 3;
-	encoding = get_encoding(pt);
-	if(encoding == ENCODING_UNKNOWN) {
-		free(msg);
+	if(lz_decompress(output, length, view->payload + 4, view->payloadLength - 4) != (int)length) {
 		return 0;
 	}
-	pt += strlen(pt) + 1;
-	retVal = scpdu_create(pdu + 2, type, encoding, pt, msgLen - strlen(msg) - 1);
+	view->payload = output;
+	view->payloadLength = length;
+	view->compressed = 0;
+	return 1;
+}
 
-	free(msg);
+SCPdu *scpdu_view_to_owned(const SCPduView *view) {
+	SCPduView inflated;
+	SCPdu *retVal;
+	unsigned char *buffer;
+
+	if(!view->compressed) {
+		return scpdu_create(view->chatID, view->type, view->encoding, view->payload, view->payloadLength);
+	}
+	inflated = *view;
+	buffer = (unsigned char*)malloc(SC_MAX_INFLATED);
+	retVal = scpdu_view_inflate(&inflated, buffer, SC_MAX_INFLATED) ? scpdu_create(inflated.chatID, inflated.type, inflated.encoding, inflated.payload, inflated.payloadLength) : 0;
+	free(buffer);
 	return retVal;
 }
 
 int scpdu_to_binary(const SCPdu *pdu, unsigned char *output, const unsigned char *key) {
-	unsigned char *pt, iv[8];
-	int msgLen;
+	SCedaKeyCtx ctx;
+
+	sceda_key_ctx_init(&ctx, key);
+	return scpdu_to_binary_ctx(pdu, output, &ctx);
+}
+
+int scpdu_to_plain_binary(const SCPdu *pdu, unsigned char *output, int *msgLen) {
+	unsigned char *pt;
 
-	if(pdu->type == PDU_UNKNOWN) {
-		return -1;
-	}
 	pt = output;
 	*(pt++) = 0;
 	*(pt++) = 1;
 	memcpy(pt, pdu->chatID, strlen(pdu->chatID) + 1);
 	pt += strlen(pdu->chatID) + 1;
-	sceda_generate_iv(iv);
-	memcpy(pt, iv, 8);
+	sceda_generate_iv(pt);
 	pt += 8;
-	msgLen = scpdutype_name(pt, pdu->type);
-	msgLen += get_encoding_name(pt + msgLen, pdu->encoding) + 1;
-	memcpy(pt + msgLen, pdu->payload, pdu->payloadLength);
-	msgLen += pdu->payloadLength;
-	msgLen = sceda_encrypt(pt, pt, msgLen, key, iv);
-	return (pt - output) + msgLen;
+	*msgLen = scpdutype_name((char*)pt, pdu->type);
+	*msgLen += get_encoding_name((char*)pt + *msgLen, pdu->encoding) + 1;
+	memcpy(pt + *msgLen, pdu->payload, pdu->payloadLength);
+	*msgLen += pdu->payloadLength;
+	return pt - output;
 }
 
-int scpdu_check_id(const unsigned char *pdu, const char *id, int pduSize) {
-	int index;
+int scpdu_to_binary_ctx(const SCPdu *pdu, unsigned char *output, const SCedaKeyCtx *ctx) {
+	int headerLen, msgLen;
 
-	if(pduSize < strlen(id) + 3) {
-		return 0;
+	if(pdu->type == PDU_UNKNOWN) {
+		return -1;
 	}
-	index = 0;
-	while(index < strlen(id) + 1) {
-		if((pdu+2)[index] != id[index++]) {
-			return 0;
+	headerLen = scpdu_to_plain_binary(pdu, output, &msgLen);
+	msgLen = sceda_encrypt_ctx(output + headerLen, output + headerLen, msgLen, ctx, output + headerLen - 8);
+	return headerLen + msgLen;
+}
+
+void scpdu_to_binary_batch(const SCPdu **pdus, unsigned char **outputs, int *lengths, int count, const SCedaKeyCtx *ctx) {
+	unsigned char *msgs[SCEDA_BATCH];
+	const unsigned char *ivs[SCEDA_BATCH];
+	int msgLens[SCEDA_BATCH], indexes[SCEDA_BATCH], group, n, m, k;
+
+	for(group = 0; group < count; group += SCEDA_BATCH) {
+		n = count - group;
+		if(n > SCEDA_BATCH) {
+			n = SCEDA_BATCH;
+		}
+		m = 0;
+		for(k = group; k < group + n; k++) {
+			if(pdus[k]->type == PDU_UNKNOWN) {
+				lengths[k] = -1;
+				continue;
+			}
+			lengths[k] = scpdu_to_plain_binary(pdus[k], outputs[k], msgLens + m);
+			msgs[m] = outputs[k] + lengths[k];
+			ivs[m] = msgs[m] - 8;
+			indexes[m++] = k;
+		}
+		sceda_encrypt_batch(msgs, (const unsigned char**)msgs, msgLens, m, ctx, ivs);
+		for(k = 0; k < m; k++) {
+			lengths[indexes[k]] += encrypted_length(msgLens[k]);
 		}
 	}
-	return 1;
+}
+
+int scpdu_check_id(const unsigned char *pdu, const char *id, int pduSize) {
+	int idLength;
+
+	idLength = strlen(id);
+	return pduSize >= idLength + 3 && !memcmp(pdu + 2, id, idLength + 1);
+}
+
+int scpdu_match_header(const unsigned char *pdu, int length, const SCHost *host) {
+	unsigned int prefix;
+
+	/* The PDU is checked in a single pass over its unencrypted header: the chatID (with its terminator) must be exactly the one of the host. */
+	if(length < 6 || length < host->chatIDLength + 3) {
+		return -1;
+	}
+	memcpy(&prefix, pdu + 2, 4);
+	if((prefix & host->chatIDPrefixMask) != host->chatIDPrefix || memcmp(pdu + 2, host->info->chatID, host->chatIDLength + 1)) {
+		return -1;
+	}
+	if(pdu[0] != 0 || pdu[1] != 1 || length < host->chatIDLength + 3 + 8 + SC_MIN_ENCRYPTED || (length - host->chatIDLength - 3 - 8) % 16) {
+		return -2;
+	}
+	return host->chatIDLength + 3;
 }
 
 void scpdu_destroy(SCPdu *pdu) {
@@ -218,325 +424,2297 @@ void scpdu_destroy(SCPdu *pdu) {
 }
 
 
-/* =============================== SCPdu =============================== */
-struct SCInfoList {
-	SCInfo *info;
-	struct SCInfoList *next;
-};
+/* =============================== SCPeerTable =============================== */
+SCPeerTable *scpeertable_create(int capacity) {
+	SCPeerTable *retVal;
 
-SCHost *schost_create(const char *nickname, const char *chatID, const unsigned char *key, int port) {
-	SCHost *retVal;
-	struct sockaddr_in loopback;
+	retVal = (SCPeerTable*)malloc(sizeof(SCPeerTable));
+	retVal->capacity = capacity;
+	retVal->count = 0;
+	retVal->slots = (SCPeer*)calloc(capacity, sizeof(SCPeer));
+	retVal->nicknames = (SCNicknameEntry*)calloc(capacity, sizeof(SCNicknameEntry));
+	return retVal;
+}
 
-	retVal = (SCHost*)malloc(sizeof(SCHost));
-	loopback.sin_family = AF_INET;
-	loopback.sin_port = htons(port);
-	loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-	bzero(loopback.sin_zero, 8);
-	retVal->info = scinfo_create(loopback, nickname, chatID);
-	memcpy(retVal->key, key, 16);
-	retVal->broadcast.sin_family = AF_INET;
-	retVal->broadcast.sin_port = htons(port);
-	retVal->broadcast.sin_addr.s_addr = htonl(INADDR_BROADCAST);
-	bzero(retVal->broadcast.sin_zero, 8);
-	retVal->socket = -1;
-	retVal->on_hello = 0;
-	retVal->on_welcome = 0;
-	retVal->on_leave = 0;
-	retVal->on_malformed_notification = 0;
-	retVal->on_malformed_received = 0;
-	retVal->on_conflict = 0;
+SCPeerTable *scpeertable_dup(const SCPeerTable *original) {
+	SCPeerTable *retVal;
+	int i;
 
+	retVal = scpeertable_create(original->capacity);
+	retVal->count = original->count;
+	memcpy(retVal->slots, original->slots, original->capacity * sizeof(SCPeer));
+	memcpy(retVal->nicknames, original->nicknames, original->capacity * sizeof(SCNicknameEntry));
+	for(i = 0; i < retVal->capacity; i++) {
+		if(retVal->slots[i].used && retVal->slots[i].longNickname) {
+			retVal->slots[i].longNickname = strdup(retVal->slots[i].longNickname);
+		}
+	}
 	return retVal;
 }
 
-int schost_add(SCHost *host, SCInfo *info, int notifyConflict) {
-	struct SCInfoList *pt;
-	int retVal;
-	SCPdu *notification;
-
-	retVal = 1;
-	if(host->others) {
-		pt = host->others;
-		while(pt) {
-			if(ntohl(pt->info->address.sin_addr.s_addr) != ntohl(info->address.sin_addr.s_addr)) {
-				retVal = 0;
-				free(pt->info->nickname);
-				pt->info->nickname = strdup(info->nickname);
-			}
-			pt = pt->next;
-		}
-		if(retVal && notifyConflict) {
-			pt = host->others;
-			while(pt) {
-				if(!strcmp(pt->info->nickname, info->nickname)) {
-					notification = scpdu_create(host->info->chatID, PDU_CNF, ENCODING_ASCII, inet_ntoa(info->address.sin_addr), strlen(inet_ntoa(info->address.sin_addr)));
-					schost_manual_send(host, pt->info->address, notification);
-					scpdu_destroy(notification);
-					notification = scpdu_create(host->info->chatID, PDU_CNF, ENCODING_ASCII, inet_ntoa(pt->info->address.sin_addr), strlen(inet_ntoa(pt->info->address.sin_addr)));
-					schost_manual_send(host, info->address, notification);
-					scpdu_destroy(notification);
-				}
-				pt = pt->next;
-			}
+void scpeertable_destroy(SCPeerTable *table) {
+	int i;
+
+	for(i = 0; i < table->capacity; i++) {
+		if(table->slots[i].used) {
+			free(table->slots[i].longNickname);
 		}
 	}
-	if(notifyConflict && !strcmp(info->nickname, host->info->nickname)) {
-		if(host->on_conflict) {
-			host->on_conflict(NULL, info);
+	free(table->slots);
+	free(table->nicknames);
+	free(table);
+}
+
+unsigned int sc_nickname_hash(const char *nickname) {
+	unsigned int retVal;
+
+	/* FNV-1a. */
+	for(retVal = 2166136261u; *nickname; nickname++) {
+		retVal = (retVal ^ (unsigned char)*nickname) * 16777619u;
+	}
+	return retVal;
+}
+
+const char *scpeer_nickname(const SCPeer *peer) {
+	return peer->longNickname ? peer->longNickname : peer->shortNickname;
+}
+
+void scpeer_set_nickname(SCPeer *peer, const char *nickname) {
+	int length;
+
+	free(peer->longNickname);
+	peer->longNickname = 0;
+	length = strlen(nickname);
+	if(length < SC_PEER_NICKNAME) {
+		memcpy(peer->shortNickname, nickname, length + 1);
+	} else {
+		peer->longNickname = strdup(nickname);
+	}
+	peer->nicknameHash = sc_nickname_hash(nickname);
+}
+
+int scpeertable_index(const SCPeerTable *table, struct sockaddr_in address) {
+	unsigned int hash;
+
+	/* Fibonacci hashing, so that the hosts of the same subnet (which only differ in the last bits) are spread over the whole table. */
+	hash = (unsigned int)address.sin_addr.s_addr * 0x9E3779B1u;
+	return (hash ^ (hash >> 16)) & (table->capacity - 1);
+}
+
+SCPeer *scpeertable_find(const SCPeerTable *table, struct sockaddr_in address) {
+	int i;
+
+	for(i = scpeertable_index(table, address); table->slots[i].used; i = (i + 1) & (table->capacity - 1)) {
+		if(table->slots[i].address.sin_addr.s_addr == address.sin_addr.s_addr) {
+			return table->slots + i;
 		}
-		notification = scpdu_create(host->info->chatID, PDU_CNF, ENCODING_ASCII, inet_ntoa(host->info->address.sin_addr), strlen(inet_ntoa(host->info->address.sin_addr)));
-		schost_manual_send(host, info->address, notification);
-		scpdu_destroy(notification);
 	}
-	if(retVal) {
-		if(host->others) {
-			pt = host->others;
-			while(pt->next) {
-				pt = pt->next;
+	return 0;
+}
+
+const SCPeer *scpeertable_find_nickname(const SCPeerTable *table, const char *nickname) {
+	const SCPeer *peer;
+	struct sockaddr_in address;
+	unsigned int hash;
+	int i;
+
+	hash = sc_nickname_hash(nickname);
+	for(i = hash & (table->capacity - 1); table->nicknames[i].used; i = (i + 1) & (table->capacity - 1)) {
+		if(table->nicknames[i].hash == hash) {
+			address.sin_addr.s_addr = table->nicknames[i].address;
+			if((peer = scpeertable_find(table, address)) && !strcmp(scpeer_nickname(peer), nickname)) {
+				return peer;
 			}
-			pt->next = (struct SCInfoList*)malloc(sizeof(struct SCInfoList));
-			pt->next->next = 0;
-			pt->next->info = scinfo_dup(info);
-		} else {
-			host->others = (struct SCInfoList*)malloc(sizeof(struct SCInfoList));
-			host->others->next = 0;
-			host->others->info = scinfo_dup(info);
 		}
 	}
+	return 0;
+}
 
-	return retVal;
+void scpeertable_index_nickname(SCPeerTable *table, const SCPeer *peer) {
+	int i;
+
+	for(i = peer->nicknameHash & (table->capacity - 1); table->nicknames[i].used; i = (i + 1) & (table->capacity - 1));
+	table->nicknames[i].hash = peer->nicknameHash;
+	table->nicknames[i].address = peer->address.sin_addr.s_addr;
+	table->nicknames[i].used = 1;
 }
 
-void *listener(void *params) {
-	SCHost *host;
-	int length, fine;
-	unsigned char buffer[SC_MAX_PDU];
-	struct sockaddr_in sender, cnfAddr;
-	socklen_t addressSize;
-	SCPdu *received, *response;
-	SCInfo *info, *cnfInfo;
-	struct SCInfoList *pt, *temp;
+void scpeertable_unindex_nickname(SCPeerTable *table, const SCPeer *peer) {
+	int i, j, k, mask;
 
-	host = (SCHost*)params;
-	addressSize = (socklen_t)sizeof(struct sockaddr_in);
-	for(;;) {
-		if(((length = recvfrom(host->socket, buffer, SC_MAX_PDU, 0, (struct sockaddr*)&sender, &addressSize)) > 0) && (ntohl(sender.sin_addr.s_addr) != ntohl(host->info->address.sin_addr.s_addr)) && scpdu_check_id(buffer, host->info->chatID, length)) {
-			if(received = scpdu_from_binary(buffer, length, host->key)) {
-				fine = 1;
-				schost_get_nickname(host, (char*)buffer, sender);
-				info = scinfo_create(sender, buffer, host->info->chatID);
-				switch(received->type) {
-					case PDU_HLO: {
-						free(info->nickname);
-						memcpy(buffer, received->payload, received->payloadLength);
-						bzero(buffer + received->payloadLength, 4);
-						to_ascii(buffer, buffer, received->encoding);
-						info->nickname = strdup(buffer);
-						if(schost_add(host, info, 1) && host->on_hello) {
-							host->on_hello(info);
-						}
-						response = scpdu_create(host->info->chatID, PDU_ACK, ENCODING_ASCII, host->info->nickname, strlen(host->info->nickname));
-						schost_manual_send(host, sender, response);
-						scpdu_destroy(response);
-						break;
-					}
-					case PDU_ACK: {
-						free(info->nickname);
-						memcpy(buffer, received->payload, received->payloadLength);
-						bzero(buffer + received->payloadLength, 4);
-						to_ascii(buffer, buffer, received->encoding);
-						info->nickname = strdup(buffer);
-						if(schost_add(host, info, 1) && host->on_welcome) {
-							host->on_welcome(info);
-						}
-						break;
-					}
-					case PDU_LEV: {
-						if(host->others) {
-							if(ntohl(host->others->info->address.sin_addr.s_addr) == ntohl(sender.sin_addr.s_addr)) {
-								temp = host->others->next;
-								scinfo_destroy(host->others->info);
-								free(host->others->info);
-								host->others->next = temp;
-							} else {
-								pt = host->others;
-								while(pt->next && (ntohl(pt->next->info->address.sin_addr.s_addr) != ntohl(sender.sin_addr.s_addr))) {
-									pt = pt->next;
-								}
-								if(pt) {
-									temp = pt->next->next;
-									scinfo_destroy(pt->next->info);
-									free(pt->next);
-									pt->next = temp;
-								}
-							}
-						}
-						if(host->on_leave) {
-							host->on_leave(info);
-						}
-						break;
-					}
-					case PDU_MSG: {
-						if(host->on_message) {
-							host->on_message(info, received);
-						}
-						break;
-					}
-					case PDU_BAD: {
-						if(host->on_malformed_notification) {
-							host->on_malformed_notification(info, received->payload, received->payloadLength);
-						}
-						break;
-					}
-					case PDU_CNF: {
-						if(host->on_conflict) {
-							memcpy(buffer, received->payload, received->payloadLength);
-							bzero(buffer + received->payloadLength, 4);
-							to_ascii(buffer, buffer, received->encoding);
-							inet_aton((char*)buffer, &(cnfAddr.sin_addr));
-							schost_get_nickname(host, buffer, cnfAddr);
-							cnfInfo = scinfo_create(cnfAddr, buffer, host->info->chatID);
-							host->on_conflict(info, cnfInfo);
-							scinfo_destroy(cnfInfo);
-						}
-						break;
-					}
-					case PDU_UNKNOWN: {
-						fine = 0;
-						break;
-					}
-				}
-				scpdu_destroy(received);
-			} else {
-				info = scinfo_create(sender, "", host->info->chatID);
-				fine = 0;
-			}
-			if(!fine) {
-				if(time(0) - host->firstBadNotification > 600) {
-					host->remainingBadNotifications = 4;
-				}
-				host->remainingBadNotifications--;
-				if(host->remainingBadNotifications > -1) {
-					response = scpdu_create(host->info->chatID, PDU_BAD, ENCODING_ASCII, 0, 0);
-					schost_manual_send(host, sender, response);
-					scpdu_destroy(response);
-					host->firstBadNotification = time(0);
-				}
-				if(host->on_malformed_notification) {
-					host->on_malformed_notification(info, buffer, length);
-				}
-			}
-			scinfo_destroy(info);
+	mask = table->capacity - 1;
+	for(i = peer->nicknameHash & mask; table->nicknames[i].used; i = (i + 1) & mask) {
+		if(table->nicknames[i].address == peer->address.sin_addr.s_addr) {
+			break;
+		}
+	}
+	if(!table->nicknames[i].used) {
+		return;
+	}
+	/* The same backward shift of scpeertable_remove. */
+	for(j = (i + 1) & mask; table->nicknames[j].used; j = (j + 1) & mask) {
+		k = table->nicknames[j].hash & mask;
+		if(i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
 		}
+		table->nicknames[i] = table->nicknames[j];
+		i = j;
 	}
+	table->nicknames[i].used = 0;
 }
 
-void schost_start(SCHost *host) {
-	struct sockaddr_in any;
-	int allowBroadcast;
-	socklen_t addressSize;
+void scpeertable_grow(SCPeerTable *table) {
+	SCPeer *old;
+	int capacity, i, j;
 
-	host->socket = socket(AF_INET, SOCK_DGRAM, 0);
-	any.sin_family = AF_INET;
-	any.sin_port = host->info->address.sin_port;
-	any.sin_addr.s_addr = htonl(INADDR_ANY);
-	bzero(any.sin_zero, 8);
-	bind(host->socket, (struct sockaddr*)&any, (socklen_t)sizeof(struct sockaddr_in));
-	allowBroadcast = 1;
-	setsockopt(host->socket, SOL_SOCKET, SO_BROADCAST, &allowBroadcast, sizeof(int));
-	addressSize = (socklen_t)sizeof(struct sockaddr_in);
-	schost_hello(host);
-	recvfrom(host->socket, 0, 0, 0, (struct sockaddr*)&(host->info->address), &addressSize);
-	host->remainingBadNotifications = 4;
-	pthread_create(&(host->listener), 0, listener, host);
+	old = table->slots;
+	capacity = table->capacity;
+	table->capacity *= 2;
+	table->slots = (SCPeer*)calloc(table->capacity, sizeof(SCPeer));
+	free(table->nicknames);
+	table->nicknames = (SCNicknameEntry*)calloc(table->capacity, sizeof(SCNicknameEntry));
+	for(i = 0; i < capacity; i++) {
+		if(old[i].used) {
+			for(j = scpeertable_index(table, old[i].address); table->slots[j].used; j = (j + 1) & (table->capacity - 1));
+			table->slots[j] = old[i];
+			scpeertable_index_nickname(table, table->slots + j);
+		}
+	}
+	free(old);
 }
 
-void schost_hello(SCHost *host) {
-	SCPdu *hello;
-	struct SCInfoList *pt, *temp;
+SCPeer *scpeertable_insert(SCPeerTable *table, struct sockaddr_in address, const char *nickname) {
+	int i;
 
-	pt = host->others;
-	while(pt) {
-		temp = pt->next;
-		scinfo_destroy(pt->info);
-		free(pt);
-		pt = temp;
+	/* The address must not be in the table already. */
+	if(2 * (table->count + 1) > table->capacity) {
+		scpeertable_grow(table);
 	}
-	host->others = 0;
+	for(i = scpeertable_index(table, address); table->slots[i].used; i = (i + 1) & (table->capacity - 1));
+	bzero(table->slots + i, sizeof(SCPeer));
+	table->slots[i].address = address;
+	table->slots[i].used = 1;
+	scpeer_set_nickname(table->slots + i, nickname);
+	scpeertable_index_nickname(table, table->slots + i);
+	table->count++;
+	return table->slots + i;
+}
 
-	hello = scpdu_create(host->info->chatID, PDU_HLO, ENCODING_ASCII, host->info->nickname, strlen(host->info->nickname));
-	schost_manual_send(host, host->broadcast, hello);
-	scpdu_destroy(hello);
+void scpeertable_rename(SCPeerTable *table, SCPeer *peer, const char *nickname) {
+	scpeertable_unindex_nickname(table, peer);
+	scpeer_set_nickname(peer, nickname);
+	scpeertable_index_nickname(table, peer);
 }
 
-int schost_get_nickname(const SCHost *host, char *output, struct sockaddr_in address) {
-	struct SCInfoList *pt;
-
-	if(host->others) {
-		pt = host->others;
-		while(pt) {
-			if(ntohl(pt->info->address.sin_addr.s_addr) == ntohl(address.sin_addr.s_addr)) {
-				memcpy(output, pt->info->nickname, strlen(pt->info->nickname) + 1);
-				return strlen(pt->info->nickname);
-			}
-			pt = pt->next;
+int scpeertable_remove(SCPeerTable *table, struct sockaddr_in address) {
+	SCPeer *peer;
+	int i, j, k, mask;
+
+	if(!(peer = scpeertable_find(table, address))) {
+		return 0;
+	}
+	scpeertable_unindex_nickname(table, peer);
+	free(peer->longNickname);
+	mask = table->capacity - 1;
+	/* The following slots of the same cluster are shifted back, so that no probe sequence is broken (and no tombstones are needed). */
+	i = peer - table->slots;
+	for(j = (i + 1) & mask; table->slots[j].used; j = (j + 1) & mask) {
+		k = scpeertable_index(table, table->slots[j].address);
+		if(i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
 		}
+		table->slots[i] = table->slots[j];
+		i = j;
 	}
-	output[0] = 0;
-	return -1;
+	table->slots[i].used = 0;
+	table->slots[i].longNickname = 0;
+	table->count--;
+	return 1;
 }
 
-void schost_send(SCHost *host, const char *message) {
-	struct SCInfoList *pt;
 
-	pt = host->others;
-	while(pt) {
-		schost_unicast_send(host, pt->info->address, message);
-		pt = pt->next;
+/* =============================== SCHost =============================== */
+const SCPeerTable *schost_peers_acquire(const SCHost *host, unsigned int *epoch) {
+	SCHost *shared;
+
+	/* Only the counters of the readers are modified. */
+	shared = (SCHost*)host;
+	for(;;) {
+		*epoch = __atomic_load_n(&(shared->peersEpoch), __ATOMIC_SEQ_CST);
+		__atomic_fetch_add(shared->peersReaders + (*epoch & 1), 1, __ATOMIC_SEQ_CST);
+		/* If the epoch has changed in the meantime, the writer might not be waiting for this reader. */
+		if(__atomic_load_n(&(shared->peersEpoch), __ATOMIC_SEQ_CST) == *epoch) {
+			break;
+		}
+		__atomic_fetch_sub(shared->peersReaders + (*epoch & 1), 1, __ATOMIC_SEQ_CST);
 	}
+	return __atomic_load_n(&(shared->peers), __ATOMIC_SEQ_CST);
 }
 
-void schost_spartan_send(SCHost *host, const char *message) {
-	schost_unicast_send(host, host->broadcast, message);
+void schost_peers_release(const SCHost *host, unsigned int epoch) {
+	__atomic_fetch_sub(((SCHost*)host)->peersReaders + (epoch & 1), 1, __ATOMIC_SEQ_CST);
 }
 
-void schost_unicast_send(SCHost *host, struct sockaddr_in address, const char *message) {
-	SCPdu *pdu;
+void schost_peers_publish(SCHost *host, SCPeerTable *table) {
+	SCPeerTable *old;
+	unsigned int epoch;
 
-	pdu = scpdu_create(host->info->chatID, PDU_MSG, ENCODING_ASCII, message, strlen(message));
-	schost_manual_send(host, address, pdu);
-	scpdu_destroy(pdu);
+	/* Called with peersLock held: the readers which have started before the new table was published are waited for before the old one is freed. */
+	old = __atomic_exchange_n(&(host->peers), table, __ATOMIC_SEQ_CST);
+	epoch = __atomic_fetch_add(&(host->peersEpoch), 1, __ATOMIC_SEQ_CST);
+	while(__atomic_load_n(host->peersReaders + (epoch & 1), __ATOMIC_SEQ_CST)) {
+		sched_yield();
+	}
+	scpeertable_destroy(old);
 }
 
-void schost_manual_send(SCHost *host, struct sockaddr_in address, const SCPdu *pdu) {
-	unsigned char binaryPdu[SC_MAX_PDU];
-	int length;
-
-	length = scpdu_to_binary(pdu, binaryPdu, host->key);
-	sendto(host->socket, binaryPdu, length, 0, (struct sockaddr*)&address, (socklen_t)sizeof(struct sockaddr_in));
-}
 
-void schost_destroy(SCHost *host) {
-	struct SCInfoList *pt, *temp;
-	SCPdu *pdu;
+SCHost *schost_create(const char *nickname, const char *chatID, const unsigned char *key, int port) {
+	SCHost *retVal;
+	struct sockaddr_in loopback;
+	int type, encoding, length;
 
-	pdu = scpdu_create(host->info->chatID, PDU_LEV, ENCODING_ASCII, 0, 0);
-	pt = host->others;
-	while(pt) {
-		if(host->socket >= 0) {
-			schost_manual_send(host, pt->info->address, pdu);
+	retVal = (SCHost*)malloc(sizeof(SCHost));
+	loopback.sin_family = AF_INET;
+	loopback.sin_port = htons(port);
+	loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bzero(loopback.sin_zero, 8);
+	retVal->info = scinfo_create(loopback, nickname, chatID);
+	retVal->chatIDLength = strlen(chatID);
+	/* The first bytes of the chatID (including its terminator, if it is shorter) are compared before the rest of it. */
+	retVal->chatIDPrefix = 0;
+	memcpy(&(retVal->chatIDPrefix), chatID, retVal->chatIDLength < 4 ? retVal->chatIDLength + 1 : 4);
+	retVal->chatIDPrefixMask = 0;
+	memset(&(retVal->chatIDPrefixMask), 0xFF, retVal->chatIDLength < 4 ? retVal->chatIDLength + 1 : 4);
+	retVal->outerHeaderLength = retVal->chatIDLength + 3;
+	retVal->outerHeader = (unsigned char*)malloc(retVal->outerHeaderLength);
+	retVal->outerHeader[0] = 0;
+	retVal->outerHeader[1] = 1;
+	memcpy(retVal->outerHeader + 2, chatID, retVal->chatIDLength + 1);
+	for(type = 0; type < SC_PDU_TYPES; type++) {
+		for(encoding = 0; encoding < 2 * ENCODINGS_COUNT; encoding++) {
+			length = scpdutype_name(retVal->innerHeaders[type][encoding], type);
+			if(length < 0 || encoding % ENCODINGS_COUNT == ENCODING_UNKNOWN) {
+				retVal->innerHeaderLengths[type][encoding] = 0;
+				continue;
+			}
+			length += get_encoding_name(retVal->innerHeaders[type][encoding] + length, encoding % ENCODINGS_COUNT);
+			if(encoding >= ENCODINGS_COUNT) {
+				memcpy(retVal->innerHeaders[type][encoding] + length, "+lz", 4);
+				length += 3;
+			}
+			retVal->innerHeaderLengths[type][encoding] = length + 1;
 		}
-		temp = pt->next;
-		scinfo_destroy(pt->info);
-		free(pt);
-		pt = temp;
 	}
-	scpdu_destroy(pdu);
-	scinfo_destroy(host->info);
+	memcpy(retVal->key, key, 16);
+	sceda_key_ctx_init(&(retVal->keyCtx), key);
+	retVal->broadcast.sin_family = AF_INET;
+	retVal->broadcast.sin_port = htons(port);
+	retVal->broadcast.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+	bzero(retVal->broadcast.sin_zero, 8);
+	retVal->peers = scpeertable_create(SC_PEER_TABLE_MIN);
+	retVal->peersEpoch = 0;
+	retVal->peersReaders[0] = 0;
+	retVal->peersReaders[1] = 0;
+	pthread_mutex_init(&(retVal->peersLock), 0);
+	retVal->keepaliveInterval = 0;
+	retVal->peerTimeout = 0;
+	sctimerwheel_init(&(retVal->timers), SC_TIMER_RESOLUTION, sc_clock());
+	sctimerwheel_init(&(retVal->responses), SC_RESPONSE_RESOLUTION, sc_clock());
+	retVal->resyncPending = 0;
+	retVal->resyncAt = 0;
+	retVal->socket = -1;
+	retVal->receiveShards = SC_RECEIVE_SHARDS;
+	retVal->shardCPU = -1;
+	retVal->shards = 0;
+	pthread_mutex_init(&(retVal->receiveLock), 0);
+	retVal->loop = 0;
+	retVal->loopTimer.prev = 0;
+	retVal->loopPort = 0;
+	retVal->encryptOnce = 0;
+	retVal->advertiseCapabilities = 0;
+	do {
+		csprng_fill((unsigned char*)&(retVal->reliableStream), sizeof(unsigned int));
+	} while(!retVal->reliableStream);
+	retVal->reliablePeers = 0;
+	pthread_mutex_init(&(retVal->reliableLock), 0);
+	csprng_fill((unsigned char*)&(retVal->nextMessageID), sizeof(unsigned int));
+	memset(retVal->reassembly, 0, sizeof(retVal->reassembly));
+	retVal->reassemblyBytes = 0;
+	retVal->on_message = 0;
+	retVal->on_message_view = 0;
+	retVal->on_message_stream = 0;
+	retVal->on_hello = 0;
+	retVal->on_welcome = 0;
+	retVal->on_leave = 0;
+	retVal->on_malformed_notification = 0;
+	retVal->on_malformed_received = 0;
+	retVal->on_conflict = 0;
+	retVal->on_reliable_failure = 0;
+
+	return retVal;
+}
+
+int sc_parse_capabilities(const unsigned char *payload, int length, KnownEncoding encoding) {
+	const unsigned char *pt, *end, *token;
+	int retVal;
+
+	/* The capabilities follow the terminator of the nickname as a comma separated list, up to the next terminator (the nicknames encoded with UTF-16 or UTF-32 contain null bytes, so they cannot have any). */
+	if(encoding == ENCODING_UTF_16_LE || encoding == ENCODING_UTF_16_BE || encoding == ENCODING_UTF_32 || !(pt = (const unsigned char*)memchr(payload, 0, length))) {
+		return 0;
+	}
+	retVal = 0;
+	if(!(end = (const unsigned char*)memchr(pt + 1, 0, payload + length - pt - 1))) {
+		end = payload + length;
+	}
+	while(pt < end) {
+		token = ++pt;
+		while(pt < end && *pt != ',') {
+			pt++;
+		}
+		if(pt - token == 2 && !memcmp(token, "lz", 2)) {
+			retVal |= SC_CAPABILITY_LZ;
+		} else if(pt - token == 4 && !memcmp(token, "sync", 4)) {
+			retVal |= SC_CAPABILITY_SYNC;
+		}
+	}
+	return retVal;
+}
+
+const unsigned char *sc_parse_digest(const unsigned char *payload, int length, KnownEncoding encoding) {
+	const unsigned char *pt;
+
+	/* The membership digest follows the terminator of the capabilities. */
+	if(encoding == ENCODING_UTF_16_LE || encoding == ENCODING_UTF_16_BE || encoding == ENCODING_UTF_32 || !(pt = (const unsigned char*)memchr(payload, 0, length)) || !(pt = (const unsigned char*)memchr(pt + 1, 0, payload + length - pt - 1))) {
+		return 0;
+	}
+	return payload + length - pt - 1 == SC_DIGEST_BYTES ? pt + 1 : 0;
+}
+
+void scdigest_add(unsigned char *digest, unsigned int hash) {
+	unsigned int step, bit;
+	int i;
+
+	/* A Bloom filter of the hashes of the nicknames, whose bits are chosen with double hashing. */
+	step = (hash * 0x9E3779B1u) | 1;
+	for(i = 0; i < SC_DIGEST_HASHES; i++) {
+		bit = (hash + i * step) % (8 * SC_DIGEST_BYTES);
+		digest[bit / 8] |= 1 << (bit % 8);
+	}
+}
+
+int scdigest_contains(const unsigned char *digest, unsigned int hash) {
+	unsigned int step, bit;
+	int i;
+
+	step = (hash * 0x9E3779B1u) | 1;
+	for(i = 0; i < SC_DIGEST_HASHES; i++) {
+		bit = (hash + i * step) % (8 * SC_DIGEST_BYTES);
+		if(!(digest[bit / 8] & (1 << (bit % 8)))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int sc_nickname_length(const unsigned char *payload, int length, KnownEncoding encoding) {
+	const unsigned char *end;
+	int unit, retVal;
+
+	/* The nickname ends with a terminator as long as a code unit of its encoding (or with the payload). */
+	unit = encoding == ENCODING_UTF_32 ? 4 : (encoding == ENCODING_UTF_16_LE || encoding == ENCODING_UTF_16_BE ? 2 : 1);
+	if(unit == 1) {
+		end = (const unsigned char*)memchr(payload, 0, length);
+		return end ? end - payload : length;
+	}
+	for(retVal = 0; retVal + unit <= length && memcmp(payload + retVal, "\0\0\0\0", unit); retVal += unit);
+	return retVal;
+}
+
+int sc_decode_text(char *output, const unsigned char *payload, int length, KnownEncoding encoding) {
+	const char *result;
+	int retVal;
+
+	/* The output must be at least 2 * length + 1 bytes long: the text is converted into a null terminated UTF-8 string. */
+	if((retVal = to_utf8(output, payload, length, encoding, &result)) >= 0) {
+		if(result != output) {
+			memcpy(output, result, retVal);
+		}
+		output[retVal] = 0;
+	}
+	return retVal;
+}
+
+int sc_decode_nickname(char *output, const unsigned char *payload, int length, KnownEncoding encoding) {
+	int retVal;
+
+	/* The nicknames which are longer than SC_MAX_NICKNAME bytes once converted are rejected, so that every known one fits in the buffers of schost_get_nickname. */
+	if((retVal = sc_decode_text(output, payload, sc_nickname_length(payload, length, encoding), encoding)) > SC_MAX_NICKNAME) {
+		return -1;
+	}
+	return retVal;
+}
+
+void schost_liveness_schedule(SCHost *host, SCPeerLiveness *liveness, long long now) {
+	long long expires, deadline;
+
+	/* The timer expires when the host has to be probed (again) or removed, whichever comes first. */
+	expires = 0;
+	if(host->keepaliveInterval) {
+		expires = liveness->lastSeen + host->keepaliveInterval;
+		if(expires <= now) {
+			expires = now + host->keepaliveInterval;
+		}
+	}
+	if(host->peerTimeout) {
+		deadline = liveness->lastSeen + host->peerTimeout;
+		if(!expires || deadline < expires) {
+			expires = deadline;
+		}
+	}
+	if(expires) {
+		sctimerwheel_add(&(host->timers), &(liveness->timer), expires);
+	}
+}
+
+SCPeerLiveness *schost_liveness_create(SCHost *host, struct sockaddr_in address) {
+	SCPeerLiveness *retVal;
+
+	retVal = (SCPeerLiveness*)malloc(sizeof(SCPeerLiveness));
+	retVal->address = address;
+	retVal->lastSeen = sc_clock();
+	retVal->timer.prev = 0;
+	retVal->response.prev = 0;
+	retVal->digest = 0;
+	schost_liveness_schedule(host, retVal, retVal->lastSeen);
+	return retVal;
+}
+
+int schost_peer_seen(SCHost *host, char *output, struct sockaddr_in address) {
+	const SCPeerTable *peers;
+	const SCPeer *peer;
+	const char *nickname;
+	unsigned int epoch;
+	int retVal;
+
+	/* Like schost_get_nickname, but the host is also marked as alive (only by the listener). */
+	peers = schost_peers_acquire(host, &epoch);
+	if((peer = scpeertable_find(peers, address))) {
+		peer->liveness->lastSeen = sc_clock();
+		nickname = scpeer_nickname(peer);
+		retVal = strlen(nickname);
+		memcpy(output, nickname, retVal + 1);
+	} else {
+		output[0] = 0;
+		retVal = -1;
+	}
+	schost_peers_release(host, epoch);
+	return retVal;
+}
+
+int schost_peer_capabilities(const SCHost *host, struct sockaddr_in address) {
+	const SCPeerTable *peers;
+	const SCPeer *peer;
+	unsigned int epoch;
+	int retVal;
+
+	peers = schost_peers_acquire(host, &epoch);
+	peer = scpeertable_find(peers, address);
+	retVal = peer ? peer->capabilities : 0;
+	schost_peers_release(host, epoch);
+	return retVal;
+}
+
+void schost_send_greeting(SCHost *host, struct sockaddr_in address, SCPduType type) {
+	const SCPeerTable *peers;
+	unsigned char payload[SC_MAX_PDU];
+	unsigned int epoch;
+	int length, broadcast, advertise, i;
+
+	length = strlen(host->info->nickname);
+	if(length + 2 + strlen(SC_CAPABILITIES) + SC_DIGEST_BYTES > SC_MAX_PDU) {
+		return;
+	}
+	memcpy(payload, host->info->nickname, length);
+	/* The clients which predate the capabilities would take them as part of the nickname, so they only get the nickname (unless the host has opted in, for the broadcast PDUs). */
+	broadcast = address.sin_addr.s_addr == host->broadcast.sin_addr.s_addr;
+	if(broadcast) {
+		advertise = host->advertiseCapabilities;
+	} else {
+		advertise = schost_peer_capabilities(host, address) != 0;
+	}
+	if(!advertise) {
+		schost_send_payload(host, address, type, ENCODING_ASCII, payload, length);
+		return;
+	}
+	payload[length] = 0;
+	memcpy(payload + length + 1, SC_CAPABILITIES, strlen(SC_CAPABILITIES));
+	length += 1 + strlen(SC_CAPABILITIES);
+	/* The membership digest lets the other hosts which are known already skip their responses to a broadcast hello PDU (the unicast PDUs only go to hosts which know this one). */
+	if(broadcast && type == PDU_HLO) {
+		payload[length++] = 0;
+		bzero(payload + length, SC_DIGEST_BYTES);
+		peers = schost_peers_acquire(host, &epoch);
+		for(i = 0; i < peers->capacity; i++) {
+			if(peers->slots[i].used) {
+				scdigest_add(payload + length, peers->slots[i].nicknameHash);
+			}
+		}
+		schost_peers_release(host, epoch);
+		length += SC_DIGEST_BYTES;
+	}
+	schost_send_payload(host, address, type, ENCODING_ASCII, payload, length);
+}
+
+int schost_add(SCHost *host, SCInfo *info, int notifyConflict) {
+	const SCPeerTable *peers;
+	const SCPeer *holder;
+	SCPeerTable *table;
+	SCPeer *peer;
+	struct sockaddr_in holderAddress;
+	char text[INET_ADDRSTRLEN];
+	unsigned int epoch;
+	int retVal;
+
+	peers = schost_peers_acquire(host, &epoch);
+	retVal = !scpeertable_find(peers, info->address);
+	holder = retVal && notifyConflict ? scpeertable_find_nickname(peers, info->nickname) : 0;
+	if(holder) {
+		holderAddress = holder->address;
+	}
+	schost_peers_release(host, epoch);
+	/* Only one of the hosts which already use the nickname is involved in the conflict: a single notification is enough for the new host to change its nickname. */
+	if(holder) {
+		inet_ntop(AF_INET, &(info->address.sin_addr), text, sizeof(text));
+		schost_send_payload(host, holderAddress, PDU_CNF, ENCODING_ASCII, (const unsigned char*)text, strlen(text));
+		inet_ntop(AF_INET, &(holderAddress.sin_addr), text, sizeof(text));
+		schost_send_payload(host, info->address, PDU_CNF, ENCODING_ASCII, (const unsigned char*)text, strlen(text));
+	}
+	if(notifyConflict && !strcmp(info->nickname, host->info->nickname)) {
+		if(host->on_conflict) {
+			host->on_conflict(NULL, info);
+		}
+		inet_ntop(AF_INET, &(host->info->address.sin_addr), text, sizeof(text));
+		schost_send_payload(host, info->address, PDU_CNF, ENCODING_ASCII, (const unsigned char*)text, strlen(text));
+	}
+	/* A new version of the table is published only if something has changed. */
+	pthread_mutex_lock(&(host->peersLock));
+	peer = scpeertable_find(host->peers, info->address);
+	if(!peer || peer->capabilities != info->capabilities || strcmp(scpeer_nickname(peer), info->nickname)) {
+		table = scpeertable_dup(host->peers);
+		if(!(peer = scpeertable_find(table, info->address))) {
+			peer = scpeertable_insert(table, info->address, info->nickname);
+			peer->liveness = schost_liveness_create(host, info->address);
+		} else if(strcmp(scpeer_nickname(peer), info->nickname)) {
+			scpeertable_rename(table, peer, info->nickname);
+		}
+		peer->capabilities = info->capabilities;
+		schost_peers_publish(host, table);
+	}
+	pthread_mutex_unlock(&(host->peersLock));
+
+	return retVal;
+}
+
+void schost_remove(SCHost *host, struct sockaddr_in address) {
+	SCPeerTable *table;
+	SCPeerLiveness *liveness;
+
+	pthread_mutex_lock(&(host->peersLock));
+	liveness = 0;
+	if(scpeertable_find(host->peers, address)) {
+		table = scpeertable_dup(host->peers);
+		liveness = scpeertable_find(table, address)->liveness;
+		scpeertable_remove(table, address);
+		schost_peers_publish(host, table);
+	}
+	pthread_mutex_unlock(&(host->peersLock));
+	/* The liveness is only used by the listener, which is the one removing the host: the old versions of the table still point to it, but they are not used for that. */
+	if(liveness) {
+		sctimerwheel_remove(&(host->timers), &(liveness->timer));
+		sctimerwheel_remove(&(host->responses), &(liveness->response));
+		free(liveness->digest);
+		free(liveness);
+	}
+	/* The messages still waiting for an acknowledgement from the host are dropped along with the rest of the channel. */
+	schost_reliable_forget(host, address);
+}
+
+void schost_liveness_expire(SCHost *host, SCPeerLiveness *liveness, long long now) {
+	const SCPeerTable *peers;
+	const SCPeer *peer;
+	SCInfo *info;
+	unsigned int epoch;
+
+	/* The liveness is freed when its host is removed, so the host is still in the table. */
+	peers = schost_peers_acquire(host, &epoch);
+	peer = scpeertable_find(peers, liveness->address);
+	info = scinfo_create(liveness->address, scpeer_nickname(peer), host->info->chatID);
+	schost_peers_release(host, epoch);
+	if(host->peerTimeout && now - liveness->lastSeen >= host->peerTimeout) {
+		schost_remove(host, info->address);
+		if(host->on_leave) {
+			host->on_leave(info);
+		}
+	} else {
+		if(host->keepaliveInterval && now - liveness->lastSeen >= host->keepaliveInterval) {
+			/* Every client answers a hello PDU with a welcome one (unless it has a membership digest which says that this host is known already). */
+			schost_send_greeting(host, liveness->address, PDU_HLO);
+		}
+		schost_liveness_schedule(host, liveness, now);
+	}
+	scinfo_destroy(info);
+}
+
+void schost_schedule_response(SCHost *host, struct sockaddr_in address, const unsigned char *digest) {
+	const SCPeerTable *peers;
+	const SCPeer *peer;
+	SCPeerLiveness *liveness;
+	unsigned int epoch, delay;
+	int jitter;
+
+	peers = schost_peers_acquire(host, &epoch);
+	peer = scpeertable_find(peers, address);
+	liveness = peer ? peer->liveness : 0;
+	jitter = SC_RESPONSE_JITTER + peers->count < SC_RESPONSE_JITTER_MAX ? SC_RESPONSE_JITTER + peers->count : SC_RESPONSE_JITTER_MAX;
+	schost_peers_release(host, epoch);
+	if(!liveness) {
+		return;
+	}
+	if(digest && scdigest_contains(digest, sc_nickname_hash(host->info->nickname))) {
+		/* The other host knows this one already (maybe from a membership PDU of a third host): the pending response is cancelled. */
+		sctimerwheel_remove(&(host->responses), &(liveness->response));
+		free(liveness->digest);
+		liveness->digest = 0;
+		return;
+	}
+	/* A keepalive probe (which has no digest) does not cancel the membership PDUs of a pending response to a broadcast hello PDU. */
+	if(digest) {
+		if(!liveness->digest) {
+			liveness->digest = (unsigned char*)malloc(SC_DIGEST_BYTES);
+		}
+		memcpy(liveness->digest, digest, SC_DIGEST_BYTES);
+	}
+	/* The window grows with the size of the chat, so that the first response can reach the other host (and suppress the rest of them) before most of the others are due. */
+	if(!liveness->response.prev) {
+		csprng_fill((unsigned char*)&delay, sizeof(unsigned int));
+		sctimerwheel_add(&(host->responses), &(liveness->response), sc_clock() + delay % jitter);
+	}
+}
+
+int schost_max_chunk(const SCHost *host, KnownEncoding encoding) {
+	/* The encrypted message takes the 7 bytes of its length and the padding up to a multiple of 16 bytes, so at least 16 bytes are reserved for them. */
+	return ((SC_MAX_PDU - host->outerHeaderLength - 8) / 16) * 16 - 16 - host->innerHeaderLengths[PDU_FRG][encoding] - SC_FRAGMENT_HEADER;
+}
+
+void schost_send_members(SCHost *host, struct sockaddr_in address, const unsigned char *digest) {
+	const SCPeerTable *peers;
+	const SCPeer *peer;
+	const char *nickname;
+	unsigned char payload[SC_MAX_PDU];
+	unsigned int epoch;
+	int capacity, length, nicknameLength, i;
+
+	/* Only the hosts which are not in the digest are listed, as many as possible in each PDU (its header is as long as the one of a fragment PDU). */
+	capacity = schost_max_chunk(host, ENCODING_UTF_8) + SC_FRAGMENT_HEADER;
+	length = 0;
+	peers = schost_peers_acquire(host, &epoch);
+	for(i = 0; i < peers->capacity; i++) {
+		peer = peers->slots + i;
+		if(!peer->used || peer->address.sin_addr.s_addr == address.sin_addr.s_addr || (digest && scdigest_contains(digest, peer->nicknameHash))) {
+			continue;
+		}
+		nickname = scpeer_nickname(peer);
+		if((nicknameLength = strlen(nickname)) > SC_MAX_NICKNAME) {
+			continue;
+		}
+		if(length + 8 + nicknameLength > capacity) {
+			schost_send_payload(host, address, PDU_MBR, ENCODING_UTF_8, payload, length);
+			length = 0;
+		}
+		memcpy(payload + length, &(peer->address.sin_addr.s_addr), 4);
+		memcpy(payload + length + 4, &(peer->address.sin_port), 2);
+		payload[length + 6] = peer->capabilities;
+		payload[length + 7] = nicknameLength;
+		memcpy(payload + length + 8, nickname, nicknameLength);
+		length += 8 + nicknameLength;
+	}
+	schost_peers_release(host, epoch);
+	if(length) {
+		schost_send_payload(host, address, PDU_MBR, ENCODING_UTF_8, payload, length);
+	}
+}
+
+void schost_respond(SCHost *host, SCPeerLiveness *liveness) {
+	schost_send_greeting(host, liveness->address, PDU_ACK);
+	/* The keepalive probes only need the welcome PDU: the other hosts are listed only to the hosts which are (re)joining, whose hello PDUs are broadcast with a digest. */
+	if(liveness->digest && schost_peer_capabilities(host, liveness->address) & SC_CAPABILITY_SYNC) {
+		schost_send_members(host, liveness->address, liveness->digest);
+	}
+	free(liveness->digest);
+	liveness->digest = 0;
+}
+
+int schost_receive_members(SCHost *host, const SCPduView *view) {
+	SCInfo *info;
+	struct sockaddr_in address;
+	char nickname[SC_MAX_NICKNAME + 1];
+	const unsigned char *pt, *end;
+	const char *text;
+	int length;
+
+	pt = view->payload;
+	end = view->payload + view->payloadLength;
+	while(pt < end) {
+		if(end - pt < 8 || end - pt < 8 + pt[7]) {
+			return 0;
+		}
+		bzero(&address, sizeof(struct sockaddr_in));
+		address.sin_family = AF_INET;
+		memcpy(&(address.sin_addr.s_addr), pt, 4);
+		memcpy(&(address.sin_port), pt + 4, 2);
+		if((length = to_utf8(nickname, pt + 8, pt[7], ENCODING_UTF_8, &text)) < 0) {
+			return 0;
+		}
+		memcpy(nickname, text, length);
+		nickname[length] = 0;
+		/* The listed hosts are added as if they had sent a welcome PDU (without conflict notifications: they have been checked by the sender). */
+		info = scinfo_create(address, nickname, host->info->chatID);
+		info->capabilities = pt[6];
+		if(schost_add(host, info, 0) && host->on_welcome) {
+			host->on_welcome(info);
+		}
+		scinfo_destroy(info);
+		pt += 8 + pt[7];
+	}
+	return 1;
+}
+
+void schost_deliver_message(SCHost *host, const SCInfo *info, const SCPduView *view) {
+	SCPdu borrowed;
+
+	if(host->on_message_view) {
+		host->on_message_view(info, view);
+	} else if(host->on_message) {
+		/* The legacy callback gets a PDU which borrows the buffers of the view as well. */
+		borrowed.chatID = (char*)view->chatID;
+		borrowed.type = view->type;
+		borrowed.encoding = view->encoding;
+		borrowed.payload = (unsigned char*)view->payload;
+		borrowed.payloadLength = view->payloadLength;
+		host->on_message(info, &borrowed);
+	}
+}
+
+int screassembly_fragment_length(const SCReassembly *slot, int index) {
+	return index < slot->count - 1 ? slot->chunkLength : slot->totalLength - (slot->count - 1) * slot->chunkLength;
+}
+
+void schost_reassembly_release(SCHost *host, SCReassembly *slot) {
+	free(slot->data);
+	free(slot->flags);
+	host->reassemblyBytes -= slot->bytes;
+	slot->data = 0;
+	slot->flags = 0;
+	slot->bytes = 0;
+	slot->count = 0;
+}
+
+void schost_reassembly_drop(SCHost *host, SCReassembly *slot) {
+	SCMessageChunk chunk;
+	SCInfo *info;
+	char nickname[SC_MAX_NICKNAME + 1];
+
+	/* A streamed message which has been partially delivered is reported as truncated. */
+	if(slot->streamed && slot->delivered && host->on_message_stream) {
+		schost_get_nickname(host, nickname, slot->sender);
+		info = scinfo_create(slot->sender, nickname, host->info->chatID);
+		chunk.messageID = slot->messageID;
+		chunk.encoding = slot->encoding;
+		chunk.offset = slot->delivered * slot->chunkLength;
+		chunk.totalLength = slot->totalLength;
+		chunk.data = 0;
+		chunk.length = 0;
+		host->on_message_stream(info, &chunk);
+		scinfo_destroy(info);
+	}
+	schost_reassembly_release(host, slot);
+}
+
+SCReassembly *schost_reassembly_oldest(SCHost *host, int withMemoryOnly) {
+	SCReassembly *retVal;
+	int i;
+
+	retVal = 0;
+	for(i = 0; i < SC_REASSEMBLY_SLOTS; i++) {
+		if(host->reassembly[i].count && (!withMemoryOnly || host->reassembly[i].bytes) && (!retVal || host->reassembly[i].lastActivity < retVal->lastActivity)) {
+			retVal = host->reassembly + i;
+		}
+	}
+	return retVal;
+}
+
+int schost_reassembly_reserve(SCHost *host, SCReassembly *slot, int length) {
+	SCReassembly *oldest;
+
+	while(host->reassemblyBytes + length > SC_REASSEMBLY_MEMORY) {
+		oldest = schost_reassembly_oldest(host, 1);
+		if(!oldest || oldest == slot) {
+			return 0;
+		}
+		schost_reassembly_drop(host, oldest);
+	}
+	host->reassemblyBytes += length;
+	slot->bytes += length;
+	return 1;
+}
+
+int schost_tick(SCHost *host) {
+	SCTimer *expired, *next;
+	long long now;
+	int i, retVal;
+
+	now = sc_clock();
+	for(i = 0; i < SC_REASSEMBLY_SLOTS; i++) {
+		if(host->reassembly[i].count && now - host->reassembly[i].lastActivity > SC_REASSEMBLY_TIMEOUT) {
+			schost_reassembly_drop(host, host->reassembly + i);
+		}
+	}
+	expired = sctimerwheel_advance(&(host->timers), now);
+	while(expired) {
+		next = expired->next;
+		schost_liveness_expire(host, (SCPeerLiveness*)expired, now);
+		expired = next;
+	}
+	expired = sctimerwheel_advance(&(host->responses), now);
+	while(expired) {
+		next = expired->next;
+		schost_respond(host, (SCPeerLiveness*)((char*)expired - offsetof(SCPeerLiveness, response)));
+		expired = next;
+	}
+	if(host->resyncAt && now >= host->resyncAt) {
+		host->resyncAt = 0;
+		schost_send_greeting(host, host->broadcast, PDU_HLO);
+	}
+	retVal = schost_reliable_tick(host, now);
+	/* The listener wakes up for the next tick of the wheels (if any timer is in them). */
+	if(host->timers.count && retVal > host->timers.current * host->timers.resolution - now) {
+		retVal = host->timers.current * host->timers.resolution - now;
+	}
+	if(host->responses.count && retVal > host->responses.current * host->responses.resolution - now) {
+		retVal = host->responses.current * host->responses.resolution - now;
+	}
+	if(host->resyncAt && retVal > host->resyncAt - now) {
+		retVal = host->resyncAt - now;
+	}
+	return retVal < SC_TICK_INTERVAL ? retVal : SC_TICK_INTERVAL;
+}
+
+SCReassembly *schost_reassembly_find(SCHost *host, struct sockaddr_in sender, unsigned int messageID, int count, int totalLength, KnownEncoding encoding) {
+	SCReassembly *retVal;
+	int i;
+
+	retVal = 0;
+	for(i = 0; i < SC_REASSEMBLY_SLOTS; i++) {
+		if(host->reassembly[i].count && host->reassembly[i].messageID == messageID && host->reassembly[i].sender.sin_addr.s_addr == sender.sin_addr.s_addr && host->reassembly[i].sender.sin_port == sender.sin_port) {
+			if(host->reassembly[i].count != count || host->reassembly[i].totalLength != totalLength || host->reassembly[i].encoding != encoding) {
+				return 0;
+			}
+			return host->reassembly + i;
+		}
+		if(!retVal && !host->reassembly[i].count) {
+			retVal = host->reassembly + i;
+		}
+	}
+	if(!retVal) {
+		retVal = schost_reassembly_oldest(host, 0);
+		schost_reassembly_drop(host, retVal);
+	}
+	retVal->sender = sender;
+	retVal->messageID = messageID;
+	retVal->encoding = encoding;
+	retVal->count = count;
+	retVal->received = 0;
+	retVal->delivered = 0;
+	retVal->totalLength = totalLength;
+	retVal->chunkLength = (totalLength + count - 1) / count;
+	retVal->streamed = host->on_message_stream != 0;
+	retVal->bytes = 0;
+	retVal->data = 0;
+	retVal->flags = 0;
+	if(!schost_reassembly_reserve(host, retVal, count + (retVal->streamed ? 0 : totalLength))) {
+		schost_reassembly_release(host, retVal);
+		return 0;
+	}
+	retVal->flags = (unsigned char*)calloc(count, 1);
+	if(!retVal->streamed) {
+		retVal->data = (unsigned char*)malloc(totalLength);
+	}
+	return retVal;
+}
+
+void schost_receive_fragment(SCHost *host, const SCInfo *info, const SCPduView *view) {
+	SCReassembly *slot;
+	SCPduView message;
+	SCMessageChunk chunk;
+	unsigned int messageID, index, count, totalLength, chunkLength;
+	const unsigned char *data;
+
+	if(view->payloadLength < SC_FRAGMENT_HEADER || !(host->on_message_stream || host->on_message_view || host->on_message)) {
+		return;
+	}
+	messageID = sc_read_uint32(view->payload);
+	index = sc_read_uint32(view->payload + 4);
+	count = sc_read_uint32(view->payload + 8);
+	totalLength = sc_read_uint32(view->payload + 12);
+	if(!count || index >= count || totalLength < count || totalLength > SC_MAX_MESSAGE) {
+		return;
+	}
+	/* Only the fragmentation used by schost_send_fragments is accepted: all the fragments but the last one are as long as possible and the last one is not empty. */
+	chunkLength = (totalLength + count - 1) / count;
+	if((count - 1) * chunkLength >= totalLength) {
+		return;
+	}
+	if((unsigned int)(view->payloadLength - SC_FRAGMENT_HEADER) != (index < count - 1 ? chunkLength : totalLength - (count - 1) * chunkLength)) {
+		return;
+	}
+	if(!(slot = schost_reassembly_find(host, info->address, messageID, count, totalLength, view->encoding)) || slot->flags[index]) {
+		return;
+	}
+	slot->flags[index] = 1;
+	slot->received++;
+	slot->lastActivity = sc_clock();
+	data = view->payload + SC_FRAGMENT_HEADER;
+	if(slot->streamed) {
+		chunk.messageID = messageID;
+		chunk.encoding = slot->encoding;
+		chunk.totalLength = totalLength;
+		if(index == (unsigned int)slot->delivered) {
+			/* The fragment is delivered directly from the receive buffer, followed by the ones which were waiting for it. */
+			chunk.offset = index * chunkLength;
+			chunk.data = data;
+			chunk.length = view->payloadLength - SC_FRAGMENT_HEADER;
+			host->on_message_stream(info, &chunk);
+			slot->delivered++;
+			while(slot->delivered < slot->count && slot->flags[slot->delivered]) {
+				chunk.offset = slot->delivered * chunkLength;
+				chunk.data = slot->data + chunk.offset;
+				chunk.length = screassembly_fragment_length(slot, slot->delivered);
+				host->on_message_stream(info, &chunk);
+				slot->delivered++;
+			}
+		} else {
+			if(!slot->data) {
+				if(!schost_reassembly_reserve(host, slot, totalLength)) {
+					schost_reassembly_drop(host, slot);
+					return;
+				}
+				slot->data = (unsigned char*)malloc(totalLength);
+			}
+			memcpy(slot->data + index * chunkLength, data, view->payloadLength - SC_FRAGMENT_HEADER);
+		}
+	} else {
+		memcpy(slot->data + index * chunkLength, data, view->payloadLength - SC_FRAGMENT_HEADER);
+	}
+	if(slot->received == slot->count) {
+		if(!slot->streamed) {
+			message.chatID = view->chatID;
+			message.type = PDU_MSG;
+			message.encoding = slot->encoding;
+			message.payload = slot->data;
+			message.payloadLength = totalLength;
+			schost_deliver_message(host, info, &message);
+		}
+		schost_reassembly_release(host, slot);
+	}
+}
+
+void schost_schedule_resync(SCHost *host) {
+	/* Only the first response to a hello PDU of the host schedules the broadcast, so that the responses which arrive in the meantime are included in its digest. */
+	if(__atomic_exchange_n(&(host->resyncPending), 0, __ATOMIC_SEQ_CST)) {
+		host->resyncAt = sc_clock() + SC_RESYNC_DELAY;
+	}
+}
+
+void schost_receive_pdu(SCHost *host, const unsigned char *pdu, int length, struct sockaddr_in sender, SCPduView *received, unsigned char *text, unsigned char *inflated) {
+	int fine;
+	struct sockaddr_in cnfAddr;
+	SCInfo *info, *cnfInfo;
+
+	/* Only message PDUs may be compressed. */
+	if(received && (!received->compressed || (received->type == PDU_MSG && scpdu_view_inflate(received, inflated, SC_MAX_INFLATED)))) {
+		fine = 1;
+		schost_peer_seen(host, (char*)text, sender);
+		info = scinfo_create(sender, (char*)text, host->info->chatID);
+		switch(received->type) {
+			case PDU_HLO: {
+				if(sc_decode_nickname((char*)text, received->payload, received->payloadLength, received->encoding) < 0) {
+					fine = 0;
+					break;
+				}
+				free(info->nickname);
+				info->nickname = strdup((char*)text);
+				info->capabilities = sc_parse_capabilities(received->payload, received->payloadLength, received->encoding);
+				if(schost_add(host, info, 1) && host->on_hello) {
+					host->on_hello(info);
+				}
+				schost_schedule_response(host, sender, sc_parse_digest(received->payload, received->payloadLength, received->encoding));
+				break;
+			}
+			case PDU_ACK: {
+				if(sc_decode_nickname((char*)text, received->payload, received->payloadLength, received->encoding) < 0) {
+					fine = 0;
+					break;
+				}
+				free(info->nickname);
+				info->nickname = strdup((char*)text);
+				info->capabilities = sc_parse_capabilities(received->payload, received->payloadLength, received->encoding);
+				if(schost_add(host, info, 1) && host->on_welcome) {
+					host->on_welcome(info);
+				}
+				schost_schedule_resync(host);
+				break;
+			}
+			case PDU_MBR: {
+				fine = schost_receive_members(host, received);
+				schost_schedule_resync(host);
+				break;
+			}
+			case PDU_LEV: {
+				schost_remove(host, sender);
+				if(host->on_leave) {
+					host->on_leave(info);
+				}
+				break;
+			}
+			case PDU_MSG: {
+				schost_deliver_message(host, info, received);
+				break;
+			}
+			case PDU_FRG: {
+				schost_receive_fragment(host, info, received);
+				break;
+			}
+			case PDU_RMS: {
+				schost_receive_reliable(host, info, received);
+				break;
+			}
+			case PDU_SAK: {
+				schost_receive_ack(host, info, received);
+				break;
+			}
+			case PDU_BAD: {
+				if(host->on_malformed_notification) {
+					host->on_malformed_notification(info, (const char*)received->payload, received->payloadLength);
+				}
+				break;
+			}
+			case PDU_CNF: {
+				if(host->on_conflict) {
+					if(sc_decode_text((char*)text, received->payload, received->payloadLength, received->encoding) < 0) {
+						fine = 0;
+						break;
+					}
+					inet_aton((char*)text, &(cnfAddr.sin_addr));
+					schost_get_nickname(host, (char*)text, cnfAddr);
+					cnfInfo = scinfo_create(cnfAddr, (char*)text, host->info->chatID);
+					host->on_conflict(info, cnfInfo);
+					scinfo_destroy(cnfInfo);
+				}
+				break;
+			}
+			case PDU_UNKNOWN: {
+				fine = 0;
+				break;
+			}
+		}
+	} else {
+		info = scinfo_create(sender, "", host->info->chatID);
+		fine = 0;
+	}
+	if(!fine) {
+		if(time(0) - host->firstBadNotification > 600) {
+			host->remainingBadNotifications = 4;
+		}
+		host->remainingBadNotifications--;
+		if(host->remainingBadNotifications > -1) {
+			schost_send_payload(host, sender, PDU_BAD, ENCODING_ASCII, 0, 0);
+			host->firstBadNotification = time(0);
+		}
+		if(host->on_malformed_notification) {
+			host->on_malformed_notification(info, (const char*)pdu, length);
+		}
+	}
+	scinfo_destroy(info);
+}
+
+int sc_broadcast_received(struct msghdr *message) {
+	struct cmsghdr *cmsg;
+	struct in_pktinfo *info;
+
+	for(cmsg = CMSG_FIRSTHDR(message); cmsg; cmsg = CMSG_NXTHDR(message, cmsg)) {
+		if(cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+			info = (struct in_pktinfo*)CMSG_DATA(cmsg);
+			/* The local address a reply would be sent from is the destination of the datagram only if it has been unicast. */
+			return info->ipi_addr.s_addr != info->ipi_spec_dst.s_addr;
+		}
+	}
+	return 0;
+}
+
+void schost_lock_listener(SCHost *host, int *cancelState) {
+	/* A shard must not be cancelled while it holds the lock, or the others would wait for it forever. */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, cancelState);
+	pthread_mutex_lock(&(host->receiveLock));
+}
+
+void schost_unlock_listener(SCHost *host, int cancelState) {
+	pthread_mutex_unlock(&(host->receiveLock));
+	pthread_setcancelstate(cancelState, 0);
+}
+
+int screceivering_receive(SCReceiveRing *ring, int socket, struct mmsghdr *messages, int withDestination) {
+	int retVal, i;
+
+	memset(messages, 0, SC_RECEIVE_BATCH * sizeof(struct mmsghdr));
+	for(i = 0; i < SC_RECEIVE_BATCH; i++) {
+		ring->iov[i].iov_base = ring->pdus[i];
+		ring->iov[i].iov_len = SC_MAX_PDU;
+		messages[i].msg_hdr.msg_iov = ring->iov + i;
+		messages[i].msg_hdr.msg_iovlen = 1;
+		messages[i].msg_hdr.msg_name = ring->senders + i;
+		messages[i].msg_hdr.msg_namelen = (socklen_t)sizeof(struct sockaddr_in);
+		if(withDestination) {
+			messages[i].msg_hdr.msg_control = ring->control[i];
+			messages[i].msg_hdr.msg_controllen = sizeof(ring->control[i]);
+		}
+	}
+	/* Everything which is already queued (up to SC_RECEIVE_BATCH datagrams) is received at once, without waiting for more. */
+	if((retVal = recvmmsg(socket, messages, SC_RECEIVE_BATCH, MSG_DONTWAIT, 0)) <= 0) {
+		return 0;
+	}
+	for(i = 0; i < retVal; i++) {
+		ring->lengths[i] = messages[i].msg_len;
+		ring->ivOffsets[i] = -1;
+		ring->hosts[i] = 0;
+	}
+	return retVal;
+}
+
+void screceivering_decrypt(SCReceiveRing *ring, int count) {
+	int pending, i, j, encLens[SC_RECEIVE_BATCH], results[SC_RECEIVE_BATCH], indices[SC_RECEIVE_BATCH];
+	unsigned char *outputs[SC_RECEIVE_BATCH];
+	const unsigned char *originals[SC_RECEIVE_BATCH], *ivs[SC_RECEIVE_BATCH];
+	char decrypted[SC_RECEIVE_BATCH];
+	SCHost *host;
+
+	/* The messages of the batch are decrypted together with the others addressed to the same host (they all are, unless they have been received by a port of a loop), before any of them is handled. */
+	memset(decrypted, 0, sizeof(decrypted));
+	for(i = 0; i < count; i++) {
+		if(decrypted[i] || !(host = ring->hosts[i]) || ring->ivOffsets[i] < 0) {
+			continue;
+		}
+		pending = 0;
+		for(j = i; j < count; j++) {
+			if(!decrypted[j] && ring->hosts[j] == host && ring->ivOffsets[j] >= 0) {
+				decrypted[j] = 1;
+				indices[pending] = j;
+				outputs[pending] = ring->scratch[j];
+				ivs[pending] = ring->pdus[j] + ring->ivOffsets[j];
+				originals[pending] = ivs[pending] + 8;
+				encLens[pending++] = ring->lengths[j] - ring->ivOffsets[j] - 8;
+			}
+		}
+		sceda_decrypt_batch(outputs, originals, encLens, results, pending, &(host->keyCtx), ivs);
+		for(j = 0; j < pending; j++) {
+			ring->msgLens[indices[j]] = results[j];
+		}
+	}
+}
+
+void screceivering_handle(SCReceiveRing *ring, int count) {
+	SCPduView received;
+	int i;
+
+	for(i = 0; i < count; i++) {
+		/* The PDUs whose header is not valid (-2) are handled as malformed, the ones of other chats (-1) are ignored. */
+		if(ring->hosts[i] && ring->ivOffsets[i] != -1) {
+			schost_receive_pdu(ring->hosts[i], ring->pdus[i], ring->lengths[i], ring->senders[i], ring->ivOffsets[i] >= 0 && scpdu_view_from_decrypted(&received, ring->pdus[i], ring->scratch[i], ring->msgLens[i]) ? &received : 0, ring->text, ring->inflated);
+		}
+	}
+}
+
+int schost_receive_batch(SCHost *host, SCReceiveShard *shard, SCReceiveRing *ring) {
+	struct mmsghdr messages[SC_RECEIVE_BATCH];
+	int count, i;
+
+	if(!(count = screceivering_receive(ring, shard->socket, messages, shard->index))) {
+		return 0;
+	}
+	for(i = 0; i < count; i++) {
+		if(ring->lengths[i] > 0 && (!shard->index || !sc_broadcast_received(&(messages[i].msg_hdr))) && ntohl(ring->senders[i].sin_addr.s_addr) != ntohl(host->info->address.sin_addr.s_addr) && (ring->ivOffsets[i] = scpdu_match_header(ring->pdus[i], ring->lengths[i], host)) != -1) {
+			ring->hosts[i] = host;
+		}
+	}
+	/* The batch is decrypted concurrently with the other shards. */
+	screceivering_decrypt(ring, count);
+	return count;
+}
+
+void *listener(void *params) {
+	SCReceiveShard *shard;
+	SCHost *host;
+	int count, timeout, cancelState;
+	struct pollfd descriptor;
+
+	shard = (SCReceiveShard*)params;
+	host = shard->host;
+	descriptor.fd = shard->socket;
+	descriptor.events = POLLIN;
+	for(;;) {
+		/* The listener wakes up at least every SC_TICK_INTERVAL milliseconds (or earlier, if a reliable message has to be retransmitted) to expire the incomplete fragmented messages. */
+		schost_lock_listener(host, &cancelState);
+		timeout = schost_tick(host);
+		schost_unlock_listener(host, cancelState);
+		if(poll(&descriptor, 1, timeout) > 0 && (count = schost_receive_batch(host, shard, shard->ring))) {
+			schost_lock_listener(host, &cancelState);
+			screceivering_handle(shard->ring, count);
+			schost_unlock_listener(host, cancelState);
+		}
+	}
+}
+
+int schost_open_socket(const SCHost *host, int shared, int withDestination) {
+	struct sockaddr_in any;
+	int retVal, enable, receiveBuffer;
+
+	retVal = socket(AF_INET, SOCK_DGRAM, 0);
+	enable = 1;
+	/* The sockets of the shards share the port, so the option must be set on each of them before it is bound. */
+	if(shared) {
+		setsockopt(retVal, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int));
+	}
+	if(withDestination) {
+		setsockopt(retVal, IPPROTO_IP, IP_PKTINFO, &enable, sizeof(int));
+	}
+	any.sin_family = AF_INET;
+	any.sin_port = host->info->address.sin_port;
+	any.sin_addr.s_addr = htonl(INADDR_ANY);
+	bzero(any.sin_zero, 8);
+	if(bind(retVal, (struct sockaddr*)&any, (socklen_t)sizeof(struct sockaddr_in))) {
+		close(retVal);
+		return -1;
+	}
+	setsockopt(retVal, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(int));
+	/* Fragmented messages arrive in bursts, which would overflow the default receive buffer. */
+	receiveBuffer = SC_RECEIVE_BUFFER;
+	setsockopt(retVal, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(int));
+	return retVal;
+}
+
+int schost_open_shards(SCHost *host) {
+	int i;
+
+	if(host->receiveShards < 1) {
+		host->receiveShards = 1;
+	}
+	host->shards = (SCReceiveShard*)malloc(host->receiveShards * sizeof(SCReceiveShard));
+	for(i = 0; i < host->receiveShards; i++) {
+		host->shards[i].host = host;
+		host->shards[i].index = i;
+		host->shards[i].ring = 0;
+		if((host->shards[i].socket = schost_open_socket(host, host->receiveShards > 1, i > 0)) < 0) {
+			while(i--) {
+				close(host->shards[i].socket);
+			}
+			free(host->shards);
+			host->shards = 0;
+			return -1;
+		}
+	}
+	host->socket = host->shards[0].socket;
+	host->remainingBadNotifications = 4;
+	schost_hello(host);
+	return 0;
+}
+
+int schost_start(SCHost *host) {
+	cpu_set_t cpus;
+	socklen_t addressSize;
+	int i;
+
+	if(schost_open_shards(host)) {
+		return -1;
+	}
+	/* The first datagram received is the hello PDU which has just been broadcast, so it comes from the address of the host. */
+	addressSize = (socklen_t)sizeof(struct sockaddr_in);
+	recvfrom(host->socket, 0, 0, 0, (struct sockaddr*)&(host->info->address), &addressSize);
+	for(i = 0; i < host->receiveShards; i++) {
+		host->shards[i].ring = (SCReceiveRing*)malloc(sizeof(SCReceiveRing));
+		pthread_create(&(host->shards[i].thread), 0, listener, host->shards + i);
+		if(host->shardCPU >= 0) {
+			CPU_ZERO(&cpus);
+			CPU_SET(host->shardCPU + i, &cpus);
+			pthread_setaffinity_np(host->shards[i].thread, sizeof(cpu_set_t), &cpus);
+		}
+	}
+	return 0;
+}
+
+SCLoop *sc_loop_create(void) {
+	SCLoop *retVal;
+
+	retVal = (SCLoop*)malloc(sizeof(SCLoop));
+#ifdef __linux__
+	retVal->descriptor = epoll_create1(0);
+#else
+	retVal->descriptor = -1;
+#endif
+	retVal->descriptors = 0;
+	retVal->ports = 0;
+	retVal->count = 0;
+	retVal->capacity = 0;
+	sctimerwheel_init(&(retVal->timers), SC_LOOP_RESOLUTION, sc_clock());
+	retVal->stopped = 0;
+
+	return retVal;
+}
+
+void sc_loop_schedule(SCLoop *loop, SCHost *host) {
+	long long now;
+
+	now = sc_clock();
+	sctimerwheel_remove(&(loop->timers), &(host->loopTimer));
+	sctimerwheel_add(&(loop->timers), &(host->loopTimer), now + schost_tick(host));
+}
+
+SCHost *scloopport_find(const SCLoopPort *port, const char *chatID) {
+	SCHost *retVal;
+	unsigned int slot;
+
+	for(slot = sc_nickname_hash(chatID); (retVal = port->hosts[slot & (port->capacity - 1)]); slot++) {
+		if(!strcmp(retVal->info->chatID, chatID)) {
+			return retVal;
+		}
+	}
+	return 0;
+}
+
+void scloopport_insert(SCLoopPort *port, SCHost *host) {
+	unsigned int slot;
+
+	for(slot = sc_nickname_hash(host->info->chatID); port->hosts[slot & (port->capacity - 1)]; slot++);
+	port->hosts[slot & (port->capacity - 1)] = host;
+}
+
+void scloopport_rebuild(SCLoopPort *port, int capacity, const SCHost *removed) {
+	SCHost **hosts;
+	int oldCapacity, i;
+
+	hosts = port->hosts;
+	oldCapacity = port->capacity;
+	port->hosts = (SCHost**)calloc(capacity, sizeof(SCHost*));
+	port->capacity = capacity;
+	port->count = 0;
+	for(i = 0; i < oldCapacity; i++) {
+		if(hosts[i] && hosts[i] != removed) {
+			scloopport_insert(port, hosts[i]);
+			port->count++;
+		}
+	}
+	free(hosts);
+}
+
+int sc_loop_add(SCLoop *loop, SCHost *host) {
+#ifdef __linux__
+	struct epoll_event event;
+#endif
+	SCLoopPort *port;
+	int i;
+
+	for(i = 0; i < loop->count && loop->ports[i]->port != host->info->address.sin_port; i++);
+	if(i < loop->count) {
+		port = loop->ports[i];
+		if(scloopport_find(port, host->info->chatID)) {
+			return -1;
+		}
+	} else {
+		if((i = schost_open_socket(host, 0, 0)) < 0) {
+			return -1;
+		}
+		port = (SCLoopPort*)malloc(sizeof(SCLoopPort));
+		port->port = host->info->address.sin_port;
+		port->socket = i;
+		port->hosts = 0;
+		port->count = 0;
+		port->capacity = 0;
+		port->addressPending = 1;
+		if(loop->count == loop->capacity) {
+			loop->capacity = loop->capacity ? 2 * loop->capacity : SC_LOOP_EVENTS;
+			loop->descriptors = (struct pollfd*)realloc(loop->descriptors, loop->capacity * sizeof(struct pollfd));
+			loop->ports = (SCLoopPort**)realloc(loop->ports, loop->capacity * sizeof(SCLoopPort*));
+		}
+		loop->descriptors[loop->count].fd = port->socket;
+		loop->descriptors[loop->count].events = POLLIN;
+		loop->ports[loop->count++] = port;
+#ifdef __linux__
+		if(loop->descriptor >= 0) {
+			event.events = EPOLLIN;
+			event.data.ptr = port;
+			epoll_ctl(loop->descriptor, EPOLL_CTL_ADD, port->socket, &event);
+		}
+#endif
+	}
+	if(2 * (port->count + 1) > port->capacity) {
+		scloopport_rebuild(port, port->capacity ? 2 * port->capacity : SC_PEER_TABLE_MIN, 0);
+	}
+	scloopport_insert(port, host);
+	port->count++;
+	if(!port->addressPending) {
+		host->info->address = port->address;
+	}
+	host->loop = loop;
+	host->loopPort = port;
+	host->socket = port->socket;
+	host->remainingBadNotifications = 4;
+	schost_hello(host);
+	sc_loop_schedule(loop, host);
+	return 0;
+}
+
+void sc_loop_remove(SCLoop *loop, SCHost *host) {
+	SCLoopPort *port;
+	int i;
+
+	port = host->loopPort;
+	scloopport_rebuild(port, port->capacity, host);
+	if(!port->count) {
+#ifdef __linux__
+		if(loop->descriptor >= 0) {
+			epoll_ctl(loop->descriptor, EPOLL_CTL_DEL, port->socket, 0);
+		}
+#endif
+		for(i = 0; loop->ports[i] != port; i++);
+		loop->count--;
+		loop->descriptors[i] = loop->descriptors[loop->count];
+		loop->ports[i] = loop->ports[loop->count];
+		close(port->socket);
+		free(port->hosts);
+		free(port);
+	}
+	sctimerwheel_remove(&(loop->timers), &(host->loopTimer));
+	host->loop = 0;
+	host->loopPort = 0;
+}
+
+int sc_loop_descriptor(const SCLoop *loop) {
+	return loop->descriptor;
+}
+
+void sc_loop_receive(SCLoop *loop, SCLoopPort *port) {
+	struct mmsghdr messages[SC_RECEIVE_BATCH];
+	SCReceiveRing *ring;
+	SCHost *host;
+	int count, i, j;
+
+	/* A single batch is handled for each ready socket, so that a busy port cannot starve the others (the socket stays ready if more datagrams are queued). */
+	ring = &(loop->ring);
+	if(!(count = screceivering_receive(ring, port->socket, messages, 0))) {
+		return;
+	}
+	for(i = 0; i < count; i++) {
+		if(port->addressPending) {
+			/* The address is the same for all the hosts of the port. */
+			port->address = ring->senders[i];
+			port->addressPending = 0;
+			for(j = 0; j < port->capacity; j++) {
+				if(port->hosts[j]) {
+					port->hosts[j]->info->address = port->address;
+				}
+			}
+			continue;
+		}
+		/* The chatID must be terminated within the datagram to be looked for (scpdu_match_header checks the rest of the header). */
+		if(ring->lengths[i] > 2 && ntohl(ring->senders[i].sin_addr.s_addr) != ntohl(port->address.sin_addr.s_addr) && memchr(ring->pdus[i] + 2, 0, ring->lengths[i] - 2) && (host = scloopport_find(port, (const char*)ring->pdus[i] + 2)) && (ring->ivOffsets[i] = scpdu_match_header(ring->pdus[i], ring->lengths[i], host)) != -1) {
+			ring->hosts[i] = host;
+		}
+	}
+	screceivering_decrypt(ring, count);
+	screceivering_handle(ring, count);
+	/* The hosts are ticked again (once each), since the PDUs might have scheduled new timers. */
+	for(i = 0; i < count; i++) {
+		for(j = 0; j < i && ring->hosts[j] != ring->hosts[i]; j++);
+		if(ring->hosts[i] && j == i) {
+			sc_loop_schedule(loop, ring->hosts[i]);
+		}
+	}
+}
+
+int sc_loop_timeout(const SCLoop *loop) {
+	long long next;
+
+	if((next = sctimerwheel_next(&(loop->timers))) < 0 || (next -= sc_clock()) > SC_TICK_INTERVAL) {
+		return SC_TICK_INTERVAL;
+	}
+	return next > 0 ? next : 0;
+}
+
+int sc_loop_run_once(SCLoop *loop, int timeout) {
+#ifdef __linux__
+	struct epoll_event events[SC_LOOP_EVENTS];
+#endif
+	SCTimer *expired, *next;
+	int ready, i;
+
+	if(timeout < 0 || timeout > sc_loop_timeout(loop)) {
+		timeout = sc_loop_timeout(loop);
+	}
+#ifdef __linux__
+	if(loop->descriptor >= 0) {
+		ready = epoll_wait(loop->descriptor, events, SC_LOOP_EVENTS, timeout);
+		for(i = 0; i < ready; i++) {
+			sc_loop_receive(loop, (SCLoopPort*)events[i].data.ptr);
+		}
+	}
+#endif
+	if(loop->descriptor < 0 && poll(loop->descriptors, loop->count, timeout) > 0) {
+		for(i = 0; i < loop->count; i++) {
+			if(loop->descriptors[i].revents) {
+				sc_loop_receive(loop, loop->ports[i]);
+			}
+		}
+	}
+	expired = sctimerwheel_advance(&(loop->timers), sc_clock());
+	while(expired) {
+		next = expired->next;
+		sc_loop_schedule(loop, (SCHost*)((char*)expired - offsetof(SCHost, loopTimer)));
+		expired = next;
+	}
+	return sc_loop_timeout(loop);
+}
+
+void sc_loop_run(SCLoop *loop) {
+	while(!__atomic_load_n(&(loop->stopped), __ATOMIC_SEQ_CST)) {
+		sc_loop_run_once(loop, -1);
+	}
+	/* The loop can be run again. */
+	__atomic_store_n(&(loop->stopped), 0, __ATOMIC_SEQ_CST);
+}
+
+void sc_loop_stop(SCLoop *loop) {
+	__atomic_store_n(&(loop->stopped), 1, __ATOMIC_SEQ_CST);
+}
+
+void sc_loop_destroy(SCLoop *loop) {
+	if(loop->descriptor >= 0) {
+		close(loop->descriptor);
+	}
+	free(loop->descriptors);
+	free(loop->ports);
+	free(loop);
+}
+
+void schost_hello(SCHost *host) {
+	/* The known hosts are kept: the digest in the hello PDU lets them skip their responses, and the others only send what is missing. */
+	__atomic_store_n(&(host->resyncPending), 1, __ATOMIC_SEQ_CST);
+	schost_send_greeting(host, host->broadcast, PDU_HLO);
+}
+
+int schost_get_nickname(const SCHost *host, char *output, struct sockaddr_in address) {
+	const SCPeerTable *peers;
+	const SCPeer *peer;
+	const char *nickname;
+	unsigned int epoch;
+	int retVal;
+
+	peers = schost_peers_acquire(host, &epoch);
+	if((peer = scpeertable_find(peers, address))) {
+		nickname = scpeer_nickname(peer);
+		retVal = strlen(nickname);
+		memcpy(output, nickname, retVal + 1);
+	} else {
+		output[0] = 0;
+		retVal = -1;
+	}
+	schost_peers_release(host, epoch);
+	return retVal;
+}
+
+int schost_plain_pdu(const SCHost *host, unsigned char *output, SCPduType type, KnownEncoding encoding, const unsigned char *prefix, int prefixLength, const unsigned char *payload, int payloadLength) {
+	int headerLen;
+
+	headerLen = host->innerHeaderLengths[type][encoding];
+	if(!headerLen || payloadLength > SC_MAX_PDU || host->outerHeaderLength + 8 + encrypted_length(headerLen + prefixLength + payloadLength) > SC_MAX_PDU) {
+		return -1;
+	}
+	memcpy(output, host->innerHeaders[type][encoding], headerLen);
+	memcpy(output + headerLen, prefix, prefixLength);
+	memcpy(output + headerLen + prefixLength, payload, payloadLength);
+	return headerLen + prefixLength + payloadLength;
+}
+
+void schost_wire_iov(const SCHost *host, struct iovec *iov, const unsigned char *iv, const unsigned char *body, int bodyLength) {
+	iov[0].iov_base = host->outerHeader;
+	iov[0].iov_len = host->outerHeaderLength;
+	iov[1].iov_base = (void*)iv;
+	iov[1].iov_len = 8;
+	iov[2].iov_base = (void*)body;
+	iov[2].iov_len = bodyLength;
+}
+
+int schost_build_pdu_prefixed(const SCHost *host, SCWirePdu *output, SCPduType type, KnownEncoding encoding, const unsigned char *prefix, int prefixLength, const unsigned char *payload, int payloadLength) {
+	int msgLen;
+
+	if((msgLen = schost_plain_pdu(host, output->body, type, encoding, prefix, prefixLength, payload, payloadLength)) < 0) {
+		return -1;
+	}
+	sceda_generate_iv(output->iv);
+	msgLen = sceda_encrypt_ctx(output->body, output->body, msgLen, &(host->keyCtx), output->iv);
+	schost_wire_iov(host, output->iov, output->iv, output->body, msgLen);
+	return host->outerHeaderLength + 8 + msgLen;
+}
+
+int schost_build_pdu(const SCHost *host, SCWirePdu *output, SCPduType type, KnownEncoding encoding, const unsigned char *payload, int payloadLength) {
+	return schost_build_pdu_prefixed(host, output, type, encoding, 0, 0, payload, payloadLength);
+}
+
+void schost_sendto_iov(SCHost *host, struct sockaddr_in address, struct iovec *iov) {
+	struct msghdr message;
+
+	memset(&message, 0, sizeof(struct msghdr));
+	message.msg_name = &address;
+	message.msg_namelen = (socklen_t)sizeof(struct sockaddr_in);
+	message.msg_iov = iov;
+	message.msg_iovlen = 3;
+	sendmsg(host->socket, &message, 0);
+}
+
+void schost_sendto_many(SCHost *host, struct iovec *iovs, int stride, const struct sockaddr_in *addresses, int count) {
+#ifdef __linux__
+	struct mmsghdr messages[SC_SEND_BATCH];
+	int n, sent, i;
+
+	while(count > 0) {
+		n = count > SC_SEND_BATCH ? SC_SEND_BATCH : count;
+		for(i = 0; i < n; i++) {
+			memset(messages + i, 0, sizeof(struct mmsghdr));
+			messages[i].msg_hdr.msg_name = (void*)(addresses + i);
+			messages[i].msg_hdr.msg_namelen = (socklen_t)sizeof(struct sockaddr_in);
+			messages[i].msg_hdr.msg_iov = iovs + i * stride;
+			messages[i].msg_hdr.msg_iovlen = 3;
+		}
+		sent = sendmmsg(host->socket, messages, n, 0);
+		if(sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if(sent <= 0) {
+			/* The first message has failed (sendmmsg only reports errors for it): it is skipped so that the others still get sent. */
+			sent = 1;
+		}
+		/* The messages which have not been sent yet (if the call has been interrupted after some of them) are sent with the next call. */
+		addresses += sent;
+		iovs += sent * stride;
+		count -= sent;
+	}
+#else
+	while(count-- > 0) {
+		schost_sendto_iov(host, *(addresses++), iovs);
+		iovs += stride;
+	}
+#endif
+}
+
+void schost_sendto_all(SCHost *host, struct iovec *iov, const struct sockaddr_in *addresses, int count) {
+	schost_sendto_many(host, iov, 0, addresses, count);
+}
+
+int schost_compress(const SCHost *host, unsigned char *output, KnownEncoding encoding, const unsigned char *message, int messageLength) {
+	int retVal;
+
+	if(messageLength < SC_COMPRESS_THRESHOLD || messageLength > SC_MAX_INFLATED) {
+		return -1;
+	}
+	if((retVal = lz_compress(output + 4, SC_MAX_PDU - 4, message, messageLength)) < 0) {
+		return -1;
+	}
+	sc_write_uint32(output, messageLength);
+	retVal += 4;
+	/* The compressed message is only worth it if it takes fewer blocks to encrypt. */
+	if(encrypted_length(host->innerHeaderLengths[PDU_MSG][SC_COMPRESSED_ENCODING(encoding)] + retVal) >= encrypted_length(host->innerHeaderLengths[PDU_MSG][encoding] + messageLength)) {
+		return -1;
+	}
+	return retVal;
+}
+
+void schost_send_fragments(SCHost *host, const struct sockaddr_in *addresses, int count, KnownEncoding encoding, const unsigned char *message, int messageLength) {
+	SCWirePdu wire;
+	unsigned char header[SC_FRAGMENT_HEADER];
+	unsigned int messageID;
+	int fragments, chunkLength, index, offset, length;
+
+	chunkLength = schost_max_chunk(host, encoding);
+	if(chunkLength <= 0 || messageLength > SC_MAX_MESSAGE) {
+		return;
+	}
+	/* The fragments are all as long as possible (but the last one), so that the receiver can compute the offset of each of them. */
+	fragments = (messageLength + chunkLength - 1) / chunkLength;
+	chunkLength = (messageLength + fragments - 1) / fragments;
+	messageID = __sync_fetch_and_add(&(host->nextMessageID), 1);
+	sc_write_uint32(header, messageID);
+	sc_write_uint32(header + 8, fragments);
+	sc_write_uint32(header + 12, messageLength);
+	for(index = 0, offset = 0; index < fragments; index++, offset += chunkLength) {
+		length = messageLength - offset < chunkLength ? messageLength - offset : chunkLength;
+		sc_write_uint32(header + 4, index);
+		schost_build_pdu_prefixed(host, &wire, PDU_FRG, encoding, header, SC_FRAGMENT_HEADER, message + offset, length);
+		schost_sendto_all(host, wire.iov, addresses, count);
+	}
+}
+
+int schost_peers_destinations(const SCHost *host, struct sockaddr_in **addresses, int **capabilities) {
+	const SCPeerTable *peers;
+	unsigned int epoch;
+	int retVal, i;
+
+	/* The destinations are copied out of a snapshot of the table, which is released before anything is sent: a long send (of a fragmented message, for example) would otherwise keep the listener waiting to publish a new table. */
+	peers = schost_peers_acquire(host, &epoch);
+	*addresses = (struct sockaddr_in*)malloc((peers->count + 1) * sizeof(struct sockaddr_in));
+	*capabilities = (int*)malloc((peers->count + 1) * sizeof(int));
+	retVal = 0;
+	for(i = 0; i < peers->capacity; i++) {
+		if(peers->slots[i].used) {
+			(*addresses)[retVal] = peers->slots[i].address;
+			(*capabilities)[retVal++] = peers->slots[i].capabilities;
+		}
+	}
+	schost_peers_release(host, epoch);
+	return retVal;
+}
+
+void schost_send_shared(SCHost *host, SCPduType type, KnownEncoding encoding, const unsigned char *payload, int payloadLength) {
+	struct sockaddr_in *addresses;
+	SCWirePdu wire;
+	int *capabilities, count, i;
+
+	if(schost_build_pdu(host, &wire, type, encoding, payload, payloadLength) < 0) {
+		return;
+	}
+	count = schost_peers_destinations(host, &addresses, &capabilities);
+	for(i = 0; i < count; i += SC_SEND_BATCH) {
+		schost_sendto_all(host, wire.iov, addresses + i, count - i < SC_SEND_BATCH ? count - i : SC_SEND_BATCH);
+	}
+	free(addresses);
+	free(capabilities);
+}
+
+void schost_send(SCHost *host, const char *message) {
+	schost_send_binary(host, ENCODING_ASCII, (const unsigned char*)message, strlen(message));
+}
+
+void schost_send_binary(SCHost *host, KnownEncoding encoding, const unsigned char *message, int messageLength) {
+	struct sockaddr_in *destinations, addresses[SC_SEND_BATCH];
+	struct iovec iovs[3 * SC_SEND_BATCH];
+	unsigned char plain[SC_MAX_PDU], compressed[SC_MAX_PDU], plainCompressed[SC_MAX_PDU], bodies[SCEDA_BATCH * SC_MAX_PDU], ivs[SC_SEND_BATCH][8], *outputs[SC_SEND_BATCH];
+	const unsigned char *originals[SC_SEND_BATCH], *ivPointers[SC_SEND_BATCH];
+	int msgLens[SC_SEND_BATCH], *capabilities, count, msgLen, compressedLength, compressedMsgLen, allCompress, n, i, next, used;
+
+	/* The message is sent to the hosts which are known when it starts being sent, even if some of them leave in the meantime. */
+	count = schost_peers_destinations(host, &destinations, &capabilities);
+	msgLen = schost_plain_pdu(host, plain, PDU_MSG, encoding, 0, 0, message, messageLength);
+	/* The message is compressed (once) only if some of the hosts support it. */
+	compressedMsgLen = -1;
+	allCompress = count != 0;
+	for(i = 0; i < count; i++) {
+		if(!(capabilities[i] & SC_CAPABILITY_LZ)) {
+			allCompress = 0;
+		} else if(compressedMsgLen == -1) {
+			compressedMsgLen = -2;
+		}
+	}
+	if(compressedMsgLen == -2 && (compressedLength = schost_compress(host, compressed, encoding, message, messageLength)) >= 0) {
+		compressedMsgLen = schost_plain_pdu(host, plainCompressed, PDU_MSG, SC_COMPRESSED_ENCODING(encoding), 0, 0, compressed, compressedLength);
+	} else {
+		compressedMsgLen = -1;
+	}
+	if(host->encryptOnce) {
+		if(allCompress && compressedMsgLen >= 0) {
+			schost_send_shared(host, PDU_MSG, SC_COMPRESSED_ENCODING(encoding), compressed, compressedLength);
+		} else if(msgLen >= 0) {
+			schost_send_shared(host, PDU_MSG, encoding, message, messageLength);
+		} else {
+			/* The message is too long for a single PDU: it is fragmented once for all the hosts. */
+			for(next = 0; next < count; next += SC_SEND_BATCH) {
+				schost_send_fragments(host, destinations + next, count - next < SC_SEND_BATCH ? count - next : SC_SEND_BATCH, encoding, message, messageLength);
+			}
+		}
+		free(destinations);
+		free(capabilities);
+		return;
+	}
+	/* Every peer gets its own initialization vector, but the encryptions of the same plaintext are batched so that their blocks are hashed together, and the encrypted PDUs are packed into a single buffer to be sent with as few system calls as possible. */
+	for(i = 0; i < SC_SEND_BATCH; i++) {
+		ivPointers[i] = ivs[i];
+	}
+	next = 0;
+	while(next < count) {
+		n = 0;
+		used = 0;
+		for(; next < count && n < SC_SEND_BATCH; next++) {
+			if(compressedMsgLen >= 0 && (capabilities[next] & SC_CAPABILITY_LZ)) {
+				originals[n] = plainCompressed;
+				msgLens[n] = compressedMsgLen;
+			} else if(msgLen >= 0) {
+				originals[n] = plain;
+				msgLens[n] = msgLen;
+			} else {
+				/* The message is too long for a single PDU: it is fragmented for this host only. */
+				schost_send_fragments(host, destinations + next, 1, encoding, message, messageLength);
+				continue;
+			}
+			/* The buffer holds at least SCEDA_BATCH PDUs: the host which does not fit is the first one of the next batch. */
+			if(used + encrypted_length(msgLens[n]) > (int)sizeof(bodies)) {
+				break;
+			}
+			outputs[n] = bodies + used;
+			used += encrypted_length(msgLens[n]);
+			addresses[n++] = destinations[next];
+		}
+		if(!n) {
+			continue;
+		}
+		csprng_fill(ivs[0], 8 * n);
+		sceda_encrypt_batch(outputs, originals, msgLens, n, &(host->keyCtx), ivPointers);
+		for(i = 0; i < n; i++) {
+			schost_wire_iov(host, iovs + 3 * i, ivs[i], outputs[i], encrypted_length(msgLens[i]));
+		}
+		schost_sendto_many(host, iovs, 3, addresses, n);
+	}
+	free(destinations);
+	free(capabilities);
+}
+
+void schost_spartan_send(SCHost *host, const char *message) {
+	schost_unicast_send(host, host->broadcast, message);
+}
+
+void schost_unicast_send(SCHost *host, struct sockaddr_in address, const char *message) {
+	schost_send_payload(host, address, PDU_MSG, ENCODING_ASCII, (const unsigned char*)message, strlen(message));
+}
+
+void schost_send_payload(SCHost *host, struct sockaddr_in address, SCPduType type, KnownEncoding encoding, const unsigned char *payload, int payloadLength) {
+	SCWirePdu wire;
+	unsigned char compressed[SC_MAX_PDU];
+	int compressedLength;
+
+	if(type == PDU_MSG && (schost_peer_capabilities(host, address) & SC_CAPABILITY_LZ) && (compressedLength = schost_compress(host, compressed, encoding, payload, payloadLength)) >= 0 && schost_build_pdu(host, &wire, PDU_MSG, SC_COMPRESSED_ENCODING(encoding), compressed, compressedLength) >= 0) {
+		schost_sendto_iov(host, address, wire.iov);
+	} else if(schost_build_pdu(host, &wire, type, encoding, payload, payloadLength) >= 0) {
+		schost_sendto_iov(host, address, wire.iov);
+	} else if(type == PDU_MSG) {
+		schost_send_fragments(host, &address, 1, encoding, payload, payloadLength);
+	}
+}
+
+void schost_manual_send(SCHost *host, struct sockaddr_in address, const SCPdu *pdu) {
+	unsigned char binaryPdu[SC_MAX_PDU];
+	int length;
+
+	if(!strcmp(pdu->chatID, host->info->chatID)) {
+		schost_send_payload(host, address, pdu->type, pdu->encoding, pdu->payload, pdu->payloadLength);
+		return;
+	}
+	length = scpdu_to_binary_ctx(pdu, binaryPdu, &(host->keyCtx));
+	sendto(host->socket, binaryPdu, length, 0, (struct sockaddr*)&address, (socklen_t)sizeof(struct sockaddr_in));
+}
+
+SCReliablePeer *schost_reliable_peer(SCHost *host, struct sockaddr_in address, int create) {
+	SCReliablePeer *retVal;
+
+	for(retVal = host->reliablePeers; retVal; retVal = retVal->next) {
+		if(retVal->address.sin_addr.s_addr == address.sin_addr.s_addr && retVal->address.sin_port == address.sin_port) {
+			return retVal;
+		}
+	}
+	if(!create) {
+		return 0;
+	}
+	retVal = (SCReliablePeer*)calloc(1, sizeof(SCReliablePeer));
+	retVal->address = address;
+	retVal->next = host->reliablePeers;
+	host->reliablePeers = retVal;
+	return retVal;
+}
+
+void screliable_free_window(SCReliableSender *sender) {
+	int i;
+
+	for(i = 0; i < SC_RELIABLE_WINDOW; i++) {
+		free(sender->window[i]);
+		sender->window[i] = 0;
+	}
+}
+
+void screliable_reset_receive(SCReliableReceiver *receiver, unsigned int stream, unsigned int base) {
+	int i;
+
+	for(i = 0; i < SC_RELIABLE_WINDOW; i++) {
+		free(receiver->held[i].data);
+		receiver->held[i].data = 0;
+	}
+	receiver->stream = stream;
+	receiver->nextExpected = base;
+}
+
+void screliable_peer_destroy(SCReliablePeer *peer) {
+	if(peer->sender) {
+		screliable_free_window(peer->sender);
+		free(peer->sender);
+	}
+	if(peer->receiver) {
+		screliable_reset_receive(peer->receiver, 0, 0);
+		free(peer->receiver);
+	}
+	free(peer);
+}
+
+void schost_reliable_forget(SCHost *host, struct sockaddr_in address) {
+	SCReliablePeer **pt, *peer;
+
+	pthread_mutex_lock(&(host->reliableLock));
+	for(pt = &(host->reliablePeers); *pt; pt = &((*pt)->next)) {
+		if((*pt)->address.sin_addr.s_addr == address.sin_addr.s_addr && (*pt)->address.sin_port == address.sin_port) {
+			peer = *pt;
+			*pt = peer->next;
+			screliable_peer_destroy(peer);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&(host->reliableLock));
+}
+
+int schost_reliable_send(SCHost *host, struct sockaddr_in address, KnownEncoding encoding, const unsigned char *message, int messageLength) {
+	SCReliablePeer *peer;
+	SCReliableSender *sender;
+	SCReliableSegment **slot, *segment;
+	unsigned char header[SC_RELIABLE_HEADER];
+
+	pthread_mutex_lock(&(host->reliableLock));
+	peer = schost_reliable_peer(host, address, 1);
+	if(!peer->sender) {
+		peer->sender = (SCReliableSender*)calloc(1, sizeof(SCReliableSender));
+		if(!(peer->sender->stream = host->reliableStream++)) {
+			peer->sender->stream = host->reliableStream++;
+		}
+		peer->sender->rto = SC_RELIABLE_INITIAL_RTO;
+	}
+	sender = peer->sender;
+	if(sender->nextSequence - sender->sendBase >= SC_RELIABLE_WINDOW) {
+		pthread_mutex_unlock(&(host->reliableLock));
+		return -1;
+	}
+	slot = sender->window + sender->nextSequence % SC_RELIABLE_WINDOW;
+	if(!*slot) {
+		*slot = (SCReliableSegment*)malloc(sizeof(SCReliableSegment));
+	}
+	segment = *slot;
+	sc_write_uint32(header, sender->stream);
+	sc_write_uint32(header + 4, sender->nextSequence);
+	sc_write_uint32(header + 8, sender->sendBase);
+	if(schost_build_pdu_prefixed(host, &(segment->wire), PDU_RMS, encoding, header, SC_RELIABLE_HEADER, message, messageLength) < 0) {
+		pthread_mutex_unlock(&(host->reliableLock));
+		return -1;
+	}
+	segment->sentAt = sc_clock();
+	segment->retransmissions = 0;
+	segment->fastRetransmitted = 0;
+	segment->pending = 1;
+	sender->nextSequence++;
+	schost_sendto_iov(host, address, segment->wire.iov);
+	pthread_mutex_unlock(&(host->reliableLock));
+	return 0;
+}
+
+void screliable_sample_rtt(SCReliableSender *sender, int rtt) {
+	int delta;
+
+	/* Jacobson/Karels estimator: the timeout is the smoothed round trip time plus four times its mean deviation. */
+	if(!sender->smoothedRTT) {
+		sender->smoothedRTT = rtt > 0 ? rtt : 1;
+		sender->rttVariation = rtt / 2;
+	} else {
+		delta = rtt - sender->smoothedRTT;
+		sender->smoothedRTT += delta / 8;
+		sender->rttVariation += ((delta < 0 ? -delta : delta) - sender->rttVariation) / 4;
+	}
+	sender->rto = sender->smoothedRTT + 4 * sender->rttVariation;
+	if(sender->rto < SC_RELIABLE_MIN_RTO) {
+		sender->rto = SC_RELIABLE_MIN_RTO;
+	} else if(sender->rto > SC_RELIABLE_MAX_RTO) {
+		sender->rto = SC_RELIABLE_MAX_RTO;
+	}
+}
+
+void schost_receive_ack(SCHost *host, const SCInfo *info, const SCPduView *view) {
+	SCReliablePeer *peer;
+	SCReliableSender *sender;
+	SCReliableSegment *segment;
+	unsigned int cumulative, sequence;
+	unsigned long long bitmap;
+	long long now;
+	int i, rtt, later;
+
+	if(view->payloadLength != 16) {
+		return;
+	}
+	cumulative = sc_read_uint32(view->payload + 4);
+	bitmap = ((unsigned long long)sc_read_uint32(view->payload + 8) << 32) | sc_read_uint32(view->payload + 12);
+	now = sc_clock();
+	rtt = -1;
+	pthread_mutex_lock(&(host->reliableLock));
+	/* The acknowledgements of hosts no reliable message has been sent to (or of a previous state of the channel) are ignored. */
+	if(!(peer = schost_reliable_peer(host, info->address, 0)) || !(sender = peer->sender) || sc_read_uint32(view->payload) != sender->stream || (int)(cumulative - sender->sendBase) < 0 || (int)(cumulative - sender->nextSequence) > 0) {
+		pthread_mutex_unlock(&(host->reliableLock));
+		return;
+	}
+	/* Karn's algorithm: only the messages which have not been retransmitted are used to measure the round trip time. */
+	for(sequence = sender->sendBase; sequence != cumulative; sequence++) {
+		segment = sender->window[sequence % SC_RELIABLE_WINDOW];
+		if(segment->pending && !segment->retransmissions) {
+			rtt = now - segment->sentAt;
+		}
+		segment->pending = 0;
+	}
+	sender->sendBase = cumulative;
+	for(i = 0; i < 64 && (int)(cumulative + 1 + i - sender->nextSequence) < 0; i++) {
+		segment = sender->window[(cumulative + 1 + i) % SC_RELIABLE_WINDOW];
+		if(((bitmap >> i) & 1) && segment->pending) {
+			if(!segment->retransmissions) {
+				rtt = now - segment->sentAt;
+			}
+			segment->pending = 0;
+		}
+	}
+	if(rtt >= 0) {
+		screliable_sample_rtt(sender, rtt);
+	}
+	/* A message which is still missing while several later ones have been acknowledged has most likely been lost: it is retransmitted without waiting for the timeout. */
+	later = 0;
+	for(sequence = sender->nextSequence; sequence != sender->sendBase; ) {
+		segment = sender->window[--sequence % SC_RELIABLE_WINDOW];
+		if(!segment->pending) {
+			later++;
+		} else if(later >= SC_RELIABLE_FAST_RETRANSMIT && !segment->fastRetransmitted) {
+			segment->fastRetransmitted = 1;
+			segment->retransmissions++;
+			segment->sentAt = now;
+			schost_sendto_iov(host, peer->address, segment->wire.iov);
+		}
+	}
+	while(sender->sendBase != sender->nextSequence && !sender->window[sender->sendBase % SC_RELIABLE_WINDOW]->pending) {
+		sender->sendBase++;
+	}
+	pthread_mutex_unlock(&(host->reliableLock));
+}
+
+int screliable_timeout(const SCReliableSender *sender, const SCReliableSegment *segment) {
+	long long retVal;
+
+	/* The timeout is doubled at each retransmission of the same message. */
+	retVal = (long long)sender->rto << (segment->retransmissions < 8 ? segment->retransmissions : 8);
+	return retVal < SC_RELIABLE_MAX_RTO ? retVal : SC_RELIABLE_MAX_RTO;
+}
+
+int schost_reliable_retransmit(SCHost *host, long long now, int *timeout, struct sockaddr_in *failed) {
+	SCReliablePeer *peer;
+	SCReliableSender *sender;
+	SCReliableSegment *segment;
+	unsigned int sequence;
+	int delay, retVal;
+
+	retVal = 0;
+	pthread_mutex_lock(&(host->reliableLock));
+	for(peer = host->reliablePeers; peer && !retVal; peer = peer->next) {
+		if(!(sender = peer->sender)) {
+			continue;
+		}
+		for(sequence = sender->sendBase; sequence != sender->nextSequence; sequence++) {
+			segment = sender->window[sequence % SC_RELIABLE_WINDOW];
+			if(!segment->pending) {
+				continue;
+			}
+			delay = screliable_timeout(sender, segment);
+			if(now - segment->sentAt < delay) {
+				if(segment->sentAt + delay - now < *timeout) {
+					*timeout = segment->sentAt + delay - now;
+				}
+			} else if(segment->retransmissions < SC_RELIABLE_MAX_RETRANSMISSIONS) {
+				segment->retransmissions++;
+				segment->sentAt = now;
+				schost_sendto_iov(host, peer->address, segment->wire.iov);
+				if((delay = screliable_timeout(sender, segment)) < *timeout) {
+					*timeout = delay;
+				}
+			} else {
+				/* The other host is most likely gone: the messages still pending are dropped, but the sequence numbers go on, so that the other host skips them if it is still there. */
+				for(sequence = sender->sendBase; sequence != sender->nextSequence; sequence++) {
+					retVal += sender->window[sequence % SC_RELIABLE_WINDOW]->pending;
+				}
+				sender->sendBase = sender->nextSequence;
+				screliable_free_window(sender);
+				*failed = peer->address;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&(host->reliableLock));
+	return retVal;
+}
+
+int schost_reliable_tick(SCHost *host, long long now) {
+	const SCPeerTable *peers;
+	const SCPeer *peer;
+	SCInfo *info;
+	struct sockaddr_in failed;
+	unsigned int epoch;
+	int retVal, count;
+
+	retVal = SC_RELIABLE_MAX_RTO;
+	/* The failures are reported without holding the lock, so that the callback can send other reliable messages. */
+	while((count = schost_reliable_retransmit(host, now, &retVal, &failed))) {
+		peers = schost_peers_acquire(host, &epoch);
+		peer = scpeertable_find(peers, failed);
+		info = scinfo_create(failed, peer ? scpeer_nickname(peer) : "", host->info->chatID);
+		schost_peers_release(host, epoch);
+		if(host->on_reliable_failure) {
+			host->on_reliable_failure(info, count);
+		}
+		scinfo_destroy(info);
+	}
+	return retVal;
+}
+
+void schost_send_ack(SCHost *host, const SCReliablePeer *peer) {
+	const SCReliableReceiver *receiver;
+	unsigned char payload[16];
+	unsigned long long bitmap;
+	int i;
+
+	receiver = peer->receiver;
+	bitmap = 0;
+	for(i = 0; i < SC_RELIABLE_WINDOW - 1; i++) {
+		if(receiver->held[(receiver->nextExpected + 1 + i) % SC_RELIABLE_WINDOW].data) {
+			bitmap |= 1ULL << i;
+		}
+	}
+	sc_write_uint32(payload, receiver->stream);
+	sc_write_uint32(payload + 4, receiver->nextExpected);
+	sc_write_uint32(payload + 8, bitmap >> 32);
+	sc_write_uint32(payload + 12, bitmap);
+	schost_send_payload(host, peer->address, PDU_SAK, ENCODING_ASCII, payload, 16);
+}
+
+void schost_receive_reliable(SCHost *host, const SCInfo *info, const SCPduView *view) {
+	SCReliablePeer *peer;
+	SCReliableReceiver *receiver;
+	SCReliableHeld *held;
+	SCPduView message;
+	unsigned int stream, sequence, base;
+	int distance;
+
+	if(view->payloadLength < SC_RELIABLE_HEADER || !(stream = sc_read_uint32(view->payload))) {
+		return;
+	}
+	sequence = sc_read_uint32(view->payload + 4);
+	base = sc_read_uint32(view->payload + 8);
+	if((int)(sequence - base) < 0) {
+		return;
+	}
+	pthread_mutex_lock(&(host->reliableLock));
+	peer = schost_reliable_peer(host, info->address, 1);
+	if(!peer->receiver) {
+		peer->receiver = (SCReliableReceiver*)calloc(1, sizeof(SCReliableReceiver));
+	}
+	receiver = peer->receiver;
+	pthread_mutex_unlock(&(host->reliableLock));
+	/* The receiving side of the peer is only accessed (and freed) by the listener. The messages before the base have been acknowledged already (possibly to a previous run of this host), so they are not waited for. */
+	if(stream != receiver->stream || (int)(base - receiver->nextExpected) > 0) {
+		screliable_reset_receive(receiver, stream, base);
+	}
+	distance = sequence - receiver->nextExpected;
+	if(distance == 0) {
+		message = *view;
+		message.type = PDU_MSG;
+		message.payload = view->payload + SC_RELIABLE_HEADER;
+		message.payloadLength = view->payloadLength - SC_RELIABLE_HEADER;
+		schost_deliver_message(host, info, &message);
+		receiver->nextExpected++;
+		while((held = receiver->held + receiver->nextExpected % SC_RELIABLE_WINDOW)->data) {
+			message.encoding = held->encoding;
+			message.payload = held->data;
+			message.payloadLength = held->length;
+			schost_deliver_message(host, info, &message);
+			free(held->data);
+			held->data = 0;
+			receiver->nextExpected++;
+		}
+	} else if(distance > 0 && distance < SC_RELIABLE_WINDOW) {
+		held = receiver->held + sequence % SC_RELIABLE_WINDOW;
+		if(!held->data) {
+			held->length = view->payloadLength - SC_RELIABLE_HEADER;
+			held->data = (unsigned char*)malloc(held->length + 1);
+			memcpy(held->data, view->payload + SC_RELIABLE_HEADER, held->length);
+			held->encoding = view->encoding;
+		}
+	}
+	/* Duplicates are acknowledged again, since the previous acknowledgement might have been lost. */
+	schost_send_ack(host, peer);
+}
+
+void schost_destroy(SCHost *host) {
+	SCReliablePeer *reliable;
+	int i;
+
 	if(host->socket >= 0) {
-		close(host->socket);
-		pthread_cancel(host->listener);
+		/* The leave PDU has no payload, so the same encryption of it is sent to every host. */
+		schost_send_shared(host, PDU_LEV, ENCODING_ASCII, 0, 0);
+		if(host->loop) {
+			/* The socket belongs to the port, which is closed along with its last host. */
+			sc_loop_remove(host->loop, host);
+		} else {
+			for(i = 0; i < host->receiveShards; i++) {
+				pthread_cancel(host->shards[i].thread);
+			}
+			for(i = 0; i < host->receiveShards; i++) {
+				pthread_join(host->shards[i].thread, 0);
+				free(host->shards[i].ring);
+				close(host->shards[i].socket);
+			}
+			free(host->shards);
+		}
+	}
+	pthread_mutex_destroy(&(host->receiveLock));
+	scinfo_destroy(host->info);
+	free(host->outerHeader);
+	sctimerwheel_clear(&(host->timers));
+	sctimerwheel_clear(&(host->responses));
+	for(i = 0; i < host->peers->capacity; i++) {
+		if(host->peers->slots[i].used) {
+			free(host->peers->slots[i].liveness->digest);
+			free(host->peers->slots[i].liveness);
+		}
+	}
+	scpeertable_destroy(host->peers);
+	pthread_mutex_destroy(&(host->peersLock));
+	for(i = 0; i < SC_REASSEMBLY_SLOTS; i++) {
+		if(host->reassembly[i].count) {
+			schost_reassembly_release(host, host->reassembly + i);
+		}
+	}
+	while(host->reliablePeers) {
+		reliable = host->reliablePeers->next;
+		screliable_peer_destroy(host->reliablePeers);
+		host->reliablePeers = reliable;
 	}
+	pthread_mutex_destroy(&(host->reliableLock));
 	free(host);
 }
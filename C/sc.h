@@ -32,16 +32,67 @@
 
 #define SC_MAX_PDU 4096
 #define SC_DEFAULT_PORT 4412
+#define SC_SEND_BATCH 64
+#define SC_FRAGMENT_HEADER 16
+#define SC_MAX_MESSAGE (16 * 1024 * 1024)
+#define SC_REASSEMBLY_SLOTS 16
+#define SC_REASSEMBLY_MEMORY (64 * 1024 * 1024)
+#define SC_REASSEMBLY_TIMEOUT 5000
+#define SC_TICK_INTERVAL 1000
+#define SC_RECEIVE_BUFFER (4 * 1024 * 1024)
+#define SC_RECEIVE_BATCH 32
+#define SC_RECEIVE_SHARDS 1
+#define SC_LOOP_EVENTS 64
+#define SC_LOOP_RESOLUTION 10
+#define SC_COMPRESS_THRESHOLD 128
+#define SC_MAX_INFLATED 65536
+#define SC_CAPABILITY_LZ 1
+#define SC_CAPABILITY_SYNC 2
+#define SC_CAPABILITIES "lz,sync"
+#define SC_DIGEST_BYTES 512
+#define SC_DIGEST_HASHES 4
+#define SC_RESPONSE_RESOLUTION 10
+#define SC_RESPONSE_JITTER 50
+#define SC_RESPONSE_JITTER_MAX 2000
+#define SC_RESYNC_DELAY 50
+#define SC_RELIABLE_HEADER 12
+#define SC_RELIABLE_WINDOW 64
+#define SC_RELIABLE_INITIAL_RTO 1000
+#define SC_RELIABLE_MIN_RTO 200
+#define SC_RELIABLE_MAX_RTO 60000
+#define SC_RELIABLE_FAST_RETRANSMIT 3
+#define SC_RELIABLE_MAX_RETRANSMISSIONS 8
+#define SC_PEER_TABLE_MIN 16
+#define SC_PEER_NICKNAME 24
+#define SC_MAX_NICKNAME 255
+#define SC_TIMER_RESOLUTION 250
+#define SC_KEEPALIVE_INTERVAL 10000
+#define SC_PEER_TIMEOUT 35000
+
+/**
+ * The minimum length of the encrypted part of a PDU (the encryption of a type acronym and an encoding name with its terminator).
+ */
+#define SC_MIN_ENCRYPTED 32
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
 #include <pthread.h>	/* -lpthread */
+#include <sched.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 #include <time.h>
 #include "encodings.h"
+#include "lz.h"
 #include "sceda.h"
+#include "timer.h"
 
 /**
  * Provides information about a communication session on a host.
@@ -50,6 +101,11 @@ struct SCInfo {
 	struct sockaddr_in address;
 	char *nickname;
 	char *chatID;
+
+	/**
+	 * The optional features the host has advertised in its hello or welcome PDU (a combination of {@link SC_CAPABILITY_LZ} flags).
+	 */
+	int capabilities;
 };
 typedef struct SCInfo SCInfo;
 
@@ -89,12 +145,12 @@ enum SCPduType {
 	PDU_UNKNOWN,
 
 	/**
-	 * Hello ("HLO") PDUs are used to discover other hosts to communicate with. They are requests for a Welcome PDU from all other hosts and they contain the nickname to be associated with the sender's IP.
+	 * Hello ("HLO") PDUs are used to discover other hosts to communicate with. They are requests for a Welcome PDU from all other hosts and they contain the nickname to be associated with the sender's IP (the nicknames longer than {@link SC_MAX_NICKNAME} bytes once converted into UTF-8 are rejected). The nickname may be followed by a terminator and the comma separated capabilities of the sender (see {@link SC_CAPABILITIES}), and then (only in the broadcast ones) by another terminator and a membership digest of the hosts known by the sender ({@link SC_DIGEST_BYTES} bytes): the clients which predate them take them as part of the nickname, so they are only sent as described by {@link SCHost#advertiseCapabilities}.
 	 */
 	PDU_HLO,
 
 	/**
-	 * Welcome ("ACK") PDUs are send as a response to Hello PDUs. They contain the nickname to be associated with the sender's IP.
+	 * Welcome ("ACK") PDUs are send as a response to Hello PDUs. They contain the nickname to be associated with the sender's IP (with the same limit and optionally followed by the capabilities of the sender, like hello PDUs).
 	 */
 	PDU_ACK,
 
@@ -116,10 +172,40 @@ enum SCPduType {
 	/**
 	 * Nickname conflict notifications ("CNF") are sent when the IPs of two different hosts are associated with the same nickname to the involved hosts. They contain the dot representation of the IP address of the host the receiver is in conflict with (or "0.0.0.0" if the receiver is in conflict with the sender).
 	 */
-	PDU_CNF
+	PDU_CNF,
+
+	/**
+	 * Fragment ("FRG") PDUs carry a part of a message which is too long for a single PDU. They contain the ID of the message, the index of the fragment, the number of fragments and the length of the whole message (as 4 bytes big endian integers each), followed by the part of the message.
+	 */
+	PDU_FRG,
+
+	/**
+	 * Reliable message ("RMS") PDUs are message PDUs which are acknowledged and retransmitted until they are. They contain the stream ID of the sender, the sequence number of the message and the oldest sequence number which has not been acknowledged yet (as 4 bytes big endian integers each), followed by the message.
+	 */
+	PDU_RMS,
+
+	/**
+	 * Selective acknowledgement ("SAK") PDUs are sent as a response to reliable message PDUs. They contain the stream ID of the acknowledged sender and the next sequence number expected from it (as 4 bytes big endian integers each), followed by a 8 bytes big endian bitmap of the messages which have been received after it (the least significant bit is for the next sequence number plus one).
+	 */
+	PDU_SAK,
+
+	/**
+	 * Membership ("MBR") PDUs are sent, after the welcome PDU, as a response to the hello PDUs with a membership digest (the broadcast ones, not the keepalive probes) of hosts which support them: they list the other hosts of the chat which are not in the membership digest of the hello PDU. Each of them is described by its IP address and port (in network byte order), its capabilities (1 byte), the length of its nickname (1 byte) and its nickname (in UTF-8).
+	 */
+	PDU_MBR
 };
 typedef enum SCPduType SCPduType;
 
+/**
+ * The index of the "+lz" variant of an encoding in the header templates of {@link SCHost}.
+ */
+#define SC_COMPRESSED_ENCODING(encoding) ((KnownEncoding)((encoding) + ENCODINGS_COUNT))
+
+/**
+ * The number of options of the {@link SCPduType} enumerator (including {@link PDU_UNKNOWN}).
+ */
+#define SC_PDU_TYPES (PDU_MBR + 1)
+
 /**
  * Converts the acronym of a type of a certain type of PDU into an option of the {@link SCPduType} enumerator.
  *
@@ -128,6 +214,14 @@ typedef enum SCPduType SCPduType;
  */
 SCPduType scpdutype_get(const char*);
 
+/**
+ * Converts the acronym of a type of PDU which is not null terminated (like the one in a decrypted PDU) into an option of the {@link SCPduType} enumerator.
+ *
+ * @param   type    A pointer to the three letters of the acronym to be converted.
+ * @return  The corresponding {@link SCPduType} option (or {@link PDU_UNKNOWN} if the acronym is not known).
+ */
+SCPduType scpdutype_get_n(const unsigned char*);
+
 /**
  * Converts an option of the {@link SCPduType} enumerator into its corresponding acronym.
  *
@@ -170,6 +264,15 @@ SCPdu *scpdu_create(const char*, SCPduType, KnownEncoding, const unsigned char*,
  */
 SCPdu *scpdu_dup(const SCPdu*);
 
+/**
+ * Checks the unencrypted header of the binary representation of a SmallChat PDU, without decrypting or allocating anything: the version bytes, the terminator of the chatID and the length of the encrypted part (which must be a multiple of 16 bytes, long enough to hold at least the length block and a block of data).
+ *
+ * @param   pdu     A pointer to the binary representation of the PDU.
+ * @param   length  The size of the PDU.
+ * @return  The offset of the initialization vector in the PDU (or {@code -1} if the header is not valid).
+ */
+int scpdu_validate(const unsigned char*, int);
+
 /**
  * Converts the binary representation of a SmallChat PDU into an instance of the {@link SCPdu} structure.
  *
@@ -181,6 +284,98 @@ SCPdu *scpdu_dup(const SCPdu*);
  */
 SCPdu *scpdu_from_binary(const unsigned char*, int, const unsigned char*);
 
+/**
+ * Converts the binary representation of a SmallChat PDU into an instance of the {@link SCPdu} structure using a key context prepared by {@link sceda_key_ctx_init}.
+ *
+ * @param   pdu     A pointer to the binary representation of the PDU.
+ * @param   length  The size of the PDU.
+ * @param   ctx     A pointer to the context of the key used to encrypt the PDU.
+ * @return  A pointer to the created instance of {@link SCPdu} (or {@code NULL} if it could not be converted).
+ */
+SCPdu *scpdu_from_binary_ctx(const unsigned char*, int, const SCedaKeyCtx*);
+
+/**
+ * Converts the binary representation of a SmallChat PDU into an instance of the {@link SCPdu} structure, decrypting it into a buffer provided by the caller instead of allocating one.
+ *
+ * @param   pdu     A pointer to the binary representation of the PDU.
+ * @param   length  The size of the PDU.
+ * @param   ctx     A pointer to the context of the key used to encrypt the PDU.
+ * @param   scratch A pointer to the buffer to be used to decrypt the PDU (it must be at least {@code length} bytes long and it must not overlap with {@code pdu}).
+ * @return  A pointer to the created instance of {@link SCPdu} (or {@code NULL} if it could not be converted).
+ */
+SCPdu *scpdu_from_binary_buffered(const unsigned char*, int, const SCedaKeyCtx*, unsigned char*);
+
+/**
+ * Represents a received SmallChat PDU without owning any of its fields: they point into the buffers the PDU has been received and decrypted into, so they are valid only as long as those buffers are not reused.
+ */
+struct SCPduView {
+	const char *chatID;
+	SCPduType type;
+	KnownEncoding encoding;
+	const unsigned char *payload;
+	int payloadLength;
+
+	/**
+	 * If not {@code 0}, the name of the encoding had the "+lz" suffix: the payload is the 4 bytes big endian length of the message followed by the message compressed with {@link lz_compress} (see {@link scpdu_view_inflate}).
+	 */
+	int compressed;
+};
+typedef struct SCPduView SCPduView;
+
+/**
+ * Parses the binary representation of a SmallChat PDU into an instance of the {@link SCPduView} structure, without allocating or copying anything but the decrypted message.
+ *
+ * @param   view    A pointer to the instance of {@link SCPduView} to be filled.
+ * @param   pdu     A pointer to the binary representation of the PDU (the chatID of the view will point into it).
+ * @param   length  The size of the PDU.
+ * @param   ctx     A pointer to the context of the key used to encrypt the PDU.
+ * @param   scratch A pointer to the buffer to be used to decrypt the PDU (it must be at least {@code length} bytes long and it must not overlap with {@code pdu}; the payload of the view will point into it).
+ * @return  {@code 1} if the PDU has been parsed, {@code 0} if it could not be converted.
+ */
+int scpdu_view_from_binary(SCPduView*, const unsigned char*, int, const SCedaKeyCtx*, unsigned char*);
+
+/**
+ * Works like {@link scpdu_view_from_binary} for a PDU whose header has already been checked by {@link scpdu_validate} or {@link scpdu_match_header}.
+ *
+ * @param   view        A pointer to the instance of {@link SCPduView} to be filled.
+ * @param   pdu         A pointer to the binary representation of the PDU.
+ * @param   length      The size of the PDU.
+ * @param   ivOffset    The offset of the initialization vector in the PDU (as returned by the validation).
+ * @param   ctx         A pointer to the context of the key used to encrypt the PDU.
+ * @param   scratch     A pointer to the buffer to be used to decrypt the PDU (see {@link scpdu_view_from_binary}).
+ * @return  {@code 1} if the PDU has been parsed, {@code 0} if it could not be converted.
+ */
+int scpdu_view_from_validated(SCPduView*, const unsigned char*, int, int, const SCedaKeyCtx*, unsigned char*);
+
+/**
+ * Works like {@link scpdu_view_from_validated} for a PDU whose message has already been decrypted (for example, together with others by {@link sceda_decrypt_batch}).
+ *
+ * @param   view    A pointer to the instance of {@link SCPduView} to be filled.
+ * @param   pdu     A pointer to the binary representation of the PDU.
+ * @param   scratch A pointer to the decrypted message (the payload of the view will point into it).
+ * @param   msgLen  The length of the decrypted message (or {@code -1} if it could not be decrypted).
+ * @return  {@code 1} if the PDU has been parsed, {@code 0} if it could not be converted.
+ */
+int scpdu_view_from_decrypted(SCPduView*, const unsigned char*, const unsigned char*, int);
+
+/**
+ * Decompresses the payload of an instance of the {@link SCPduView} structure (if it is compressed), so that it points into a buffer provided by the caller.
+ *
+ * @param   view        A pointer to the instance of {@link SCPduView} to be decompressed.
+ * @param   output      The buffer to be written the decompressed payload into.
+ * @param   capacity    The size of the buffer.
+ * @return  {@code 1} if the payload is not compressed (anymore), {@code 0} if it is malformed or too long for the buffer.
+ */
+int scpdu_view_inflate(SCPduView*, unsigned char*, int);
+
+/**
+ * Copies an instance of the {@link SCPduView} structure into a new instance of the {@link SCPdu} structure, which can be kept after the buffers of the view are reused (a compressed payload is decompressed).
+ *
+ * @param   view    A pointer to the instance of {@link SCPduView} to be copied.
+ * @return  A pointer to the created instance of {@link SCPdu} (or {@code NULL} if the payload could not be decompressed).
+ */
+SCPdu *scpdu_view_to_owned(const SCPduView*);
+
 /**int scpdu_to_binary(const SCPdu *pdu, unsigned char *output, const unsigned char *key)
  * Converts an instance of the {@link SCPdu} structure into the binary representation of the PDU.
  *
@@ -191,6 +386,27 @@ SCPdu *scpdu_from_binary(const unsigned char*, int, const unsigned char*);
  */
 int scpdu_to_binary(const SCPdu*, unsigned char*, const unsigned char*);
 
+/**
+ * Converts an instance of the {@link SCPdu} structure into the binary representation of the PDU using a key context prepared by {@link sceda_key_ctx_init}.
+ *
+ * @param   pdu     A pointer to the instance of {@link SCPdu} to be converted.
+ * @param   output  A pointer to the buffer to be written the binary output into.
+ * @param   ctx     A pointer to the context of the key to be used to encrypt the PDU.
+ * @return  The length of the binary representation of the PDU.
+ */
+int scpdu_to_binary_ctx(const SCPdu*, unsigned char*, const SCedaKeyCtx*);
+
+/**
+ * Converts several instances of the {@link SCPdu} structure into the binary representations of the PDUs at once, encrypting them together (each PDU gets its own initialization vector).
+ *
+ * @param   pdus    The instances of {@link SCPdu} to be converted (the same instance may appear more than once).
+ * @param   outputs The buffers to be written the binary outputs into.
+ * @param   lengths The array to be written the lengths of the binary representations of the PDUs into (or {@code -1} for the PDUs which could not be converted).
+ * @param   count   The number of PDUs to be converted.
+ * @param   ctx     A pointer to the context of the key to be used to encrypt the PDUs.
+ */
+void scpdu_to_binary_batch(const SCPdu**, unsigned char**, int*, int, const SCedaKeyCtx*);
+
 /**
  * Checks if the chatID of a PDU is the given one without trying to parse the PDU itself.
  *
@@ -201,6 +417,343 @@ int scpdu_to_binary(const SCPdu*, unsigned char*, const unsigned char*);
  */
 int scpdu_check_id(const unsigned char*, const char*, int);
 
+/**
+ * Represents a part of a fragmented message, delivered in order as soon as it (and all the parts before it) has been received.
+ */
+struct SCMessageChunk {
+	unsigned int messageID;
+	KnownEncoding encoding;
+
+	/**
+	 * The position of the part in the message and the length of the whole message.
+	 */
+	int offset;
+	int totalLength;
+
+	/**
+	 * The content of the part (or {@code NULL} if the rest of the message has been dropped, because it has not been completed in time).
+	 */
+	const unsigned char *data;
+	int length;
+};
+typedef struct SCMessageChunk SCMessageChunk;
+
+/**
+ * Represents a fragmented message which is being received.
+ */
+struct SCReassembly {
+	struct sockaddr_in sender;
+	unsigned int messageID;
+	KnownEncoding encoding;
+
+	/**
+	 * The number of fragments of the message ({@code 0} if the slot is not in use), the number of them which have been received and the number of them which have been delivered in order.
+	 */
+	int count;
+	int received;
+	int delivered;
+	int totalLength;
+	int chunkLength;
+
+	/**
+	 * If not {@code 0}, the message is delivered to {@link SCHost#on_message_stream}, part by part. The number of bytes allocated for the message is counted against {@link SC_REASSEMBLY_MEMORY}.
+	 */
+	int streamed;
+	int bytes;
+
+	/**
+	 * The fragments which have been received (only the ones which could not be delivered yet are stored if the message is streamed) and one flag for each of them.
+	 */
+	unsigned char *data;
+	unsigned char *flags;
+	long long lastActivity;
+};
+typedef struct SCReassembly SCReassembly;
+
+/**
+ * Represents an encrypted SmallChat PDU ready to be sent with {@code sendmsg}, built from the header templates of a host.
+ */
+struct SCWirePdu {
+	/**
+	 * The parts of the PDU: the unencrypted header of the host, the initialization vector and the encrypted message.
+	 */
+	struct iovec iov[3];
+	unsigned char iv[8];
+	unsigned char body[SC_MAX_PDU];
+};
+typedef struct SCWirePdu SCWirePdu;
+
+/**
+ * Represents a reliable message which has been sent but not acknowledged yet.
+ */
+struct SCReliableSegment {
+	SCWirePdu wire;
+
+	/**
+	 * The time the message has been sent last, the number of times it has been retransmitted and if it has already been retransmitted because later messages have been acknowledged before it.
+	 */
+	long long sentAt;
+	int retransmissions;
+	int fastRetransmitted;
+
+	/**
+	 * {@code 0} if the message has been acknowledged.
+	 */
+	int pending;
+};
+typedef struct SCReliableSegment SCReliableSegment;
+
+/**
+ * Represents a reliable message which has been received before some of the messages which precede it.
+ */
+struct SCReliableHeld {
+	unsigned char *data;
+	int length;
+	KnownEncoding encoding;
+};
+typedef struct SCReliableHeld SCReliableHeld;
+
+/**
+ * Represents the sending side of the reliable channel with another host.
+ */
+struct SCReliableSender {
+	/**
+	 * The stream ID of the channel: a new one is used whenever the state of the channel is created again, so that the other host can tell that its sequence numbers start over.
+	 */
+	unsigned int stream;
+
+	/**
+	 * The oldest message which has not been acknowledged yet, the sequence number of the next message to be sent and the messages which have been sent in between (indexed by their sequence number modulo {@link SC_RELIABLE_WINDOW}, each one allocated when its slot is first used).
+	 */
+	unsigned int sendBase;
+	unsigned int nextSequence;
+	SCReliableSegment *window[SC_RELIABLE_WINDOW];
+
+	/**
+	 * The smoothed round trip time, its variation and the retransmission timeout (in milliseconds).
+	 */
+	int smoothedRTT;
+	int rttVariation;
+	int rto;
+};
+typedef struct SCReliableSender SCReliableSender;
+
+/**
+ * Represents the receiving side of the reliable channel with another host (only accessed by the listener).
+ */
+struct SCReliableReceiver {
+	/**
+	 * The stream ID of the other host ({@code 0} before any reliable message has been received), the next sequence number expected from it and the messages received after it.
+	 */
+	unsigned int stream;
+	unsigned int nextExpected;
+	SCReliableHeld held[SC_RELIABLE_WINDOW];
+};
+typedef struct SCReliableReceiver SCReliableReceiver;
+
+/**
+ * Represents the state of the reliable channel with another host: each side is only allocated once a reliable message is sent to or received from it.
+ */
+struct SCReliablePeer {
+	struct sockaddr_in address;
+	SCReliableSender *sender;
+	SCReliableReceiver *receiver;
+
+	struct SCReliablePeer *next;
+};
+typedef struct SCReliablePeer SCReliablePeer;
+
+/**
+ * Represents the state of the listener about another host of the chat: the last time it has been heard from and the pending response to its hello PDU.
+ */
+struct SCPeerLiveness {
+	/**
+	 * The timer in {@link SCHost#timers} (the first member, so that an expired timer is a pointer to its liveness), which expires when the host has to be probed or removed (it is not moved when the host is heard from: the time is checked again when it expires).
+	 */
+	SCTimer timer;
+	struct sockaddr_in address;
+	long long lastSeen;
+
+	/**
+	 * The timer in {@link SCHost#responses}, which expires when the response to the last hello PDU of the host has to be sent, and the last membership digest received since the previous response ({@code 0} if only keepalive probes, which have none, have been received: then no membership PDU is sent).
+	 */
+	SCTimer response;
+	unsigned char *digest;
+};
+typedef struct SCPeerLiveness SCPeerLiveness;
+
+/**
+ * Represents another host of the chat, as a slot of a {@link SCPeerTable}.
+ */
+struct SCPeer {
+	struct sockaddr_in address;
+	int capabilities;
+
+	/**
+	 * {@code 0} if the slot is empty.
+	 */
+	int used;
+
+	/**
+	 * The nickname of the host: it is stored in {@code shortNickname} if it fits there (terminator included), otherwise it is dynamically allocated in {@code longNickname}.
+	 */
+	char shortNickname[SC_PEER_NICKNAME];
+	char *longNickname;
+
+	/**
+	 * The hash of the nickname, computed once when it is set (it is the key of the host in the nickname index of the table).
+	 */
+	unsigned int nicknameHash;
+
+	/**
+	 * The state of the listener about the host, which is shared by all the versions of the table.
+	 */
+	SCPeerLiveness *liveness;
+};
+typedef struct SCPeer SCPeer;
+
+/**
+ * Represents a host in the nickname index of a {@link SCPeerTable}.
+ */
+struct SCNicknameEntry {
+	unsigned int hash;
+	in_addr_t address;
+
+	/**
+	 * {@code 0} if the entry is empty.
+	 */
+	int used;
+};
+typedef struct SCNicknameEntry SCNicknameEntry;
+
+/**
+ * Represents the other hosts of the chat, as an open addressing hash table (with linear probing) indexed by their IP address.
+ */
+struct SCPeerTable {
+	/**
+	 * The slots of the table (their number is a power of two and at most half of them are used).
+	 */
+	SCPeer *slots;
+	int capacity;
+	int count;
+
+	/**
+	 * The index of the hosts by nickname (an open addressing hash table as large as {@link SCPeerTable#slots}, where the hosts which share a nickname have an entry each).
+	 */
+	SCNicknameEntry *nicknames;
+};
+typedef struct SCPeerTable SCPeerTable;
+
+/**
+ * Represents the buffers the listener of a host receives up to {@link SC_RECEIVE_BATCH} datagrams into with a single {@code recvmmsg} call, and decrypts them into together.
+ */
+struct SCReceiveRing {
+	unsigned char pdus[SC_RECEIVE_BATCH][SC_MAX_PDU];
+	unsigned char scratch[SC_RECEIVE_BATCH][SC_MAX_PDU];
+	struct sockaddr_in senders[SC_RECEIVE_BATCH];
+	struct iovec iov[SC_RECEIVE_BATCH];
+
+	/**
+	 * The destination addresses of the datagrams (only requested by the shards which must skip the broadcast ones, see {@link SCReceiveShard}).
+	 */
+	unsigned char control[SC_RECEIVE_BATCH][CMSG_SPACE(sizeof(struct in_pktinfo))];
+
+	/**
+	 * The lengths of the datagrams, the offsets of their initialization vectors (as returned by {@link scpdu_match_header}) and the lengths of the decrypted messages.
+	 */
+	int lengths[SC_RECEIVE_BATCH];
+	int ivOffsets[SC_RECEIVE_BATCH];
+	int msgLens[SC_RECEIVE_BATCH];
+
+	/**
+	 * The hosts the datagrams are addressed to ({@code NULL} for the ones which are ignored): they are all the same, unless the datagrams have been received by a {@link SCLoopPort}.
+	 */
+	struct SCHost *hosts[SC_RECEIVE_BATCH];
+
+	/**
+	 * The buffers used to handle the PDUs one at a time.
+	 */
+	unsigned char text[2 * SC_MAX_PDU + 1];
+	unsigned char inflated[SC_MAX_INFLATED];
+};
+typedef struct SCReceiveRing SCReceiveRing;
+
+struct SCHost;
+
+/**
+ * Represents one of the sockets the datagrams addressed to a host are received from (all of them are bound to the same port with {@code SO_REUSEPORT}, so that the kernel spreads the senders among them) and the thread which listens to it. Every broadcast datagram is delivered to all the sockets, so only the first shard handles them.
+ */
+struct SCReceiveShard {
+	struct SCHost *host;
+	int index;
+	int socket;
+	pthread_t thread;
+
+	/**
+	 * The buffers of the thread.
+	 */
+	SCReceiveRing *ring;
+};
+typedef struct SCReceiveShard SCReceiveShard;
+
+/**
+ * Represents a port the hosts of a {@link SCLoop} are bound to: the hosts of all the chats on the same port share a single socket, and the datagrams received from it are routed to them by chatID.
+ */
+struct SCLoopPort {
+	in_port_t port;
+	int socket;
+
+	/**
+	 * The hosts, in an open addressing table indexed by the hash of their chatID (its capacity is a power of 2, at least twice the number of hosts).
+	 */
+	struct SCHost **hosts;
+	int count;
+	int capacity;
+
+	/**
+	 * The address the datagrams sent from the socket come from: the hosts do not wait for their own hello PDU (like {@link schost_start} does), the first datagram received from the socket is taken as the one of the first host instead. {@code addressPending} is set until then.
+	 */
+	struct sockaddr_in address;
+	int addressPending;
+};
+typedef struct SCLoopPort SCLoopPort;
+
+/**
+ * Represents an event loop which listens to the sockets of many hosts on a single thread (instead of one thread for each of them), with epoll (or poll, where it is not available).
+ */
+struct SCLoop {
+	/**
+	 * The epoll instance (or {@code -1}, if poll is used) and the sockets registered with the loop, along with the ports they belong to.
+	 */
+	int descriptor;
+	struct pollfd *descriptors;
+	SCLoopPort **ports;
+	int count;
+	int capacity;
+
+	/**
+	 * The hosts are ticked (see {@link SCHost#loopTimer}) by the timers of this wheel, so that the loop only wakes up when one of them has something to do.
+	 */
+	SCTimerWheel timers;
+	int stopped;
+
+	/**
+	 * The buffers the datagrams are received into, shared by all the ports.
+	 */
+	SCReceiveRing ring;
+};
+typedef struct SCLoop SCLoop;
+
+/**
+ * Checks if the chatID of a PDU is the one of a host and validates the rest of its unencrypted header (like {@link scpdu_validate}) in a single pass, using the chatID length and prefix precomputed by {@link schost_create}.
+ *
+ * @param   pdu     A pointer to the binary representation of the PDU.
+ * @param   length  The size of the PDU.
+ * @param   host    A pointer to the host the PDU should be addressed to.
+ * @return  The offset of the initialization vector in the PDU, {@code -1} if the chatID of the PDU is not the one of the host or {@code -2} if it is but the header is not valid.
+ */
+int scpdu_match_header(const unsigned char*, int, const struct SCHost*);
+
 /**
  * Destroys an instance of the {@link SCPdu} structure created with {@link scpdu_create}, {@link scpdu_dup} or {@link scpdu_from_binary}.
  *
@@ -209,21 +762,99 @@ int scpdu_check_id(const unsigned char*, const char*, int);
 void scpdu_destroy(SCPdu*);
 
 
-struct SCInfoList;
-
 /**
  * Represents a local SmallChat client.
  */
 struct SCHost {
 	SCInfo *info;
+
+	/**
+	 * The length of the chatID of the host and its first four bytes (only the ones selected by {@link SCHost#chatIDPrefixMask}), which are used by {@link scpdu_match_header}.
+	 */
+	int chatIDLength;
+	unsigned int chatIDPrefix;
+	unsigned int chatIDPrefixMask;
+
+	/**
+	 * The unencrypted header shared by all the PDUs sent by the host (the version bytes and the chatID with its terminator).
+	 */
+	unsigned char *outerHeader;
+	int outerHeaderLength;
+
+	/**
+	 * The first bytes of the decrypted message of the PDUs sent by the host (the type acronym and the name of the encoding with its terminator), for each type and encoding, followed by the ones of the compressed variants of the encodings (see {@link SC_COMPRESSED_ENCODING}). The length is {@code 0} for invalid pairs.
+	 */
+	char innerHeaders[SC_PDU_TYPES][2 * ENCODINGS_COUNT][20];
+	int innerHeaderLengths[SC_PDU_TYPES][2 * ENCODINGS_COUNT];
+
 	unsigned char key[16];
+	SCedaKeyCtx keyCtx;
 	struct sockaddr_in broadcast;
-	struct SCInfoList *others;
+
+	/**
+	 * The other hosts of the chat. A published table is never modified: it is replaced by a modified copy (under {@link SCHost#peersLock}), so that it can be read without locks, and it is freed once the readers which might still use it (counted in {@link SCHost#peersReaders} by the parity of {@link SCHost#peersEpoch}) are done.
+	 */
+	SCPeerTable *peers;
+	unsigned int peersEpoch;
+	int peersReaders[2];
+	pthread_mutex_t peersLock;
 	int socket;
-	pthread_t listener;
+
+	/**
+	 * The datagrams are received by {@code receiveShards} threads, each with its own socket (the one of the first shard is {@code socket}, which is also used to send), pinned to the CPUs from {@code shardCPU} on (or not pinned, if it is {@code -1}): both must be set before {@link schost_start}. The state of the listener (its timers, the fragmented messages being received and the malformed PDU notifications) is shared by the shards and protected by {@code receiveLock}, so the callbacks are never called concurrently.
+	 */
+	int receiveShards;
+	int shardCPU;
+	SCReceiveShard *shards;
+	pthread_mutex_t receiveLock;
+
+	/**
+	 * The loop the host has been added to with {@link sc_loop_add} (or {@code NULL}, if it has its own threads), the port of the loop whose socket it uses and the timer the loop ticks it with.
+	 */
+	SCLoop *loop;
+	SCLoopPort *loopPort;
+	SCTimer loopTimer;
 	int remainingBadNotifications;
 	time_t firstBadNotification;
 
+	/**
+	 * The other hosts are probed with a unicast hello PDU when they have not been heard from for {@code keepaliveInterval} milliseconds and removed (as if they had left) after {@code peerTimeout} milliseconds ({@code 0} disables either of them: both must be set before {@link schost_start}). Both are disabled by default, since the hosts which predate the probes take each of them as the hello PDU of a new host: {@link SC_KEEPALIVE_INTERVAL} and {@link SC_PEER_TIMEOUT} are suitable values in chats without such hosts. The timers of the listener are kept in {@code timers}.
+	 */
+	int keepaliveInterval;
+	int peerTimeout;
+	SCTimerWheel timers;
+
+	/**
+	 * The responses to hello PDUs are delayed randomly (see {@link SC_RESPONSE_JITTER}), so that they can be cancelled if the other host learns about this one in the meantime. The hello PDU of the host is broadcast again (with the updated membership digest) {@link SC_RESYNC_DELAY} milliseconds after the first response to it, if {@code resyncPending} is set ({@code resyncAt} is {@code 0} if no broadcast is scheduled).
+	 */
+	SCTimerWheel responses;
+	int resyncPending;
+	long long resyncAt;
+
+	/**
+	 * The ID of the next fragmented message sent by the host and the fragmented messages which are being received (only used by the listener).
+	 */
+	unsigned int nextMessageID;
+	SCReassembly reassembly[SC_REASSEMBLY_SLOTS];
+	int reassemblyBytes;
+
+	/**
+	 * The stream ID of the next reliable channel opened by the host (chosen randomly, so that the other hosts can tell when it has been restarted, and incremented for each channel) and the states of the reliable channels with the other hosts (protected by {@link SCHost#reliableLock}, and dropped when the other host leaves).
+	 */
+	unsigned int reliableStream;
+	SCReliablePeer *reliablePeers;
+	pthread_mutex_t reliableLock;
+
+	/**
+	 * If not {@code 0}, {@link schost_send} encrypts each message only once and sends the same bytes (and initialization vector) to every known host, instead of encrypting it again for each of them.
+	 */
+	int encryptOnce;
+
+	/**
+	 * If not {@code 0}, the broadcast hello PDUs of the host advertise its capabilities (see {@link PDU_HLO}), so that the other hosts send it compressed messages and membership PDUs. The unicast hello and welcome PDUs advertise them anyway, but only to the hosts which have advertised theirs. It is {@code 0} by default, since it breaks the nicknames shown by the clients which predate the capabilities: it should only be set in chats without such clients.
+	 */
+	int advertiseCapabilities;
+
 	/**
 	 * Called when a valid message PDU is received.
 	 * @param   info    A pointer to the instance of {@link SCInfo} which provides information about the sender.
@@ -231,6 +862,20 @@ struct SCHost {
 	 */
 	void (*on_message)(const SCInfo*, const SCPdu*);
 
+	/**
+	 * Called instead of {@link SCHost#on_message} (if set) when a valid message PDU is received, without copying the PDU.
+	 * @param   info    A pointer to the instance of {@link SCInfo} which provides information about the sender.
+	 * @param   pdu     A pointer to received PDU (it is valid only until the function returns: {@link scpdu_view_to_owned} shall be used to keep it).
+	 */
+	void (*on_message_view)(const SCInfo*, const SCPduView*);
+
+	/**
+	 * Called (if set) for each part of a fragmented message, in order, instead of reassembling the whole message for {@link SCHost#on_message_view} or {@link SCHost#on_message}.
+	 * @param   info    A pointer to the instance of {@link SCInfo} which provides information about the sender.
+	 * @param   chunk   A pointer to the received part (it is valid only until the function returns).
+	 */
+	void (*on_message_stream)(const SCInfo*, const SCMessageChunk*);
+
 	/**
 	 * Called when a valid hello PDU is received.
 	 * @param   info    A pointer to the instance of {@link SCInfo} which provides information about the sender.
@@ -238,7 +883,7 @@ struct SCHost {
 	void (*on_hello)(const SCInfo*);
 
 	/**
-	 * Called when a valid welcome PDU is received.
+	 * Called when a valid welcome PDU is received (or when another host of the chat is learned from a membership PDU).
 	 * @param   info    A pointer to the instance of {@link SCInfo} which provides information about the sender.
 	 */
 	void (*on_welcome)(const SCInfo*);
@@ -271,13 +916,20 @@ struct SCHost {
 	 * @param	rivalInfo		A pointer to the instance of {@link SCInfo} which provides information about the host this host is in conflict with.
 	 */
 	void (*on_conflict)(const SCInfo*, const SCInfo*);
+
+	/**
+	 * Called when a reliable message has been retransmitted {@link SC_RELIABLE_MAX_RETRANSMISSIONS} times without being acknowledged: the messages still waiting for an acknowledgement from the same host are dropped.
+	 * @param   info    A pointer to the instance of {@link SCInfo} which provides information about the host the messages were sent to.
+	 * @param   count   The number of dropped messages.
+	 */
+	void (*on_reliable_failure)(const SCInfo*, int);
 };
 typedef struct SCHost SCHost;
 
 /**
  * Dynamically allocates and initializes a new instance of the {@link SCHost} structure. {@link schost_start} should be called then (after the function pointers in the instance are set).
  *
- * @param   nickname    The nickname to be associated with this host (it will be duplicated).
+ * @param   nickname    The nickname to be associated with this host (it will be duplicated; the other hosts reject nicknames longer than {@link SC_MAX_NICKNAME} bytes).
  * @param   chatID      The chatID of the communication this host will take part into (it will be duplicated).
  * @param   key         A pointer to the encryption key used in this communication (it must be 16 bytes long and it will be duplicated).
  * @param   port        The port to be used in this communication.
@@ -286,11 +938,12 @@ typedef struct SCHost SCHost;
 SCHost *schost_create(const char*, const char*, const unsigned char*, int);
 
 /**
- * Initializes some fields of an instance of the {@link SCHost} struct, sends a broadcast hello PDU and starts a new thread to listen to messages from other hosts. It shall be called only once for each {@link SCHost} instance.
+ * Initializes some fields of an instance of the {@link SCHost} struct, sends a broadcast hello PDU and starts new threads (one for each of the {@link SCHost#receiveShards} shards) to listen to messages from other hosts. It shall be called only once for each {@link SCHost} instance.
  *
  * @param   host    A pointer to the host to be started.
+ * @return  {@code 0} if the host has been started, {@code -1} if its port could not be bound (for example, because another host uses it already): then the host can only be destroyed.
  */
-void schost_start(SCHost*);
+int schost_start(SCHost*);
 
 /**
  * Sends a broadcast hello PDU and updates the list of known hosts.
@@ -303,11 +956,36 @@ void schost_hello(SCHost*);
  * Return the nickname associated with a given known host.
  *
  * @param   host    A pointer to the host of which the known hosts list is to be used ({@link schost_start} should have been called for this host).
- * @param   output  The buffer to be written the nickname into (if the host is not found, {@code '\0'} will be written in the first byte.
+ * @param   output  The buffer to be written the nickname into, at least {@link SC_MAX_NICKNAME} + 1 bytes long (if the host is not found, {@code '\0'} will be written in the first byte).
  * @param   address	The address of the host to be looked for in the list of known hosts (or {@code -1} if it has not been found).
  */
 int schost_get_nickname(const SCHost*, char*, struct sockaddr_in);
 
+/**
+ * Builds a PDU of the host's communication from its header templates, encrypting the message directly into the instance of {@link SCWirePdu}.
+ *
+ * @param   host            A pointer to the host which has to send the PDU.
+ * @param   output          A pointer to the instance of {@link SCWirePdu} to be filled.
+ * @param   type            The type of the PDU.
+ * @param   encoding        The encoding of the payload.
+ * @param   payload         A pointer to the payload of the PDU.
+ * @param   payloadLength   The length of the payload.
+ * @return  The total length of the PDU (or {@code -1} if the type or the encoding is not valid or the PDU would be longer than {@link SC_MAX_PDU}).
+ */
+int schost_build_pdu(const SCHost*, SCWirePdu*, SCPduType, KnownEncoding, const unsigned char*, int);
+
+/**
+ * Sends a PDU of the host's communication to a given address, without allocating an instance of {@link SCPdu}. Message PDUs which are too long for a single PDU are split into fragment PDUs.
+ *
+ * @param   host            A pointer to the host which has to send the PDU ({@link schost_start} must have been called for this host).
+ * @param   address         The address the PDU has to be sent to.
+ * @param   type            The type of the PDU.
+ * @param   encoding        The encoding of the payload.
+ * @param   payload         A pointer to the payload of the PDU.
+ * @param   payloadLength   The length of the payload.
+ */
+void schost_send_payload(SCHost*, struct sockaddr_in, SCPduType, KnownEncoding, const unsigned char*, int);
+
 /**
  * Sends a unicast message PDU to all known hosts.
  *
@@ -316,6 +994,28 @@ int schost_get_nickname(const SCHost*, char*, struct sockaddr_in);
  */
 void schost_send(SCHost*, const char*);
 
+/**
+ * Sends a unicast message PDU with an arbitrary payload to all known hosts (if it is too long for a single PDU, it is split into fragment PDUs).
+ *
+ * @param   host            A pointer to the host which has to send the message ({@link schost_start} must have been called for this host).
+ * @param   encoding        The encoding of the message.
+ * @param   message         A pointer to the message to be sent.
+ * @param   messageLength   The length of the message (at most {@link SC_MAX_MESSAGE}).
+ */
+void schost_send_binary(SCHost*, KnownEncoding, const unsigned char*, int);
+
+/**
+ * Sends a reliable message PDU to the given host: it is retransmitted (with a timeout adapted to the round trip time) until the host acknowledges it (or until it has been retransmitted {@link SC_RELIABLE_MAX_RETRANSMISSIONS} times, then {@link SCHost#on_reliable_failure} is called), and the host delivers the reliable messages from this host in order through {@link SCHost#on_message_view} or {@link SCHost#on_message}.
+ *
+ * @param   host            A pointer to the host which has to send the message ({@link schost_start} must have been called for this host).
+ * @param   address         The address of the host the message has to be sent to.
+ * @param   encoding        The encoding of the message.
+ * @param   message         A pointer to the message to be sent.
+ * @param   messageLength   The length of the message (it must fit in a single PDU).
+ * @return  {@code 0} if the message has been sent, {@code -1} if it is too long or if {@link SC_RELIABLE_WINDOW} messages to the same host are still waiting for an acknowledgement (in that case, it should be sent again later).
+ */
+int schost_reliable_send(SCHost*, struct sockaddr_in, KnownEncoding, const unsigned char*, int);
+
 /**
  * Sends a broadcast message PDU.
  *
@@ -344,8 +1044,62 @@ void schost_manual_send(SCHost*, struct sockaddr_in, const SCPdu*);
 /**
  * Destroys an instance of the {@link SCHost} structure created with {@link schost_create}.
  *
- * @param   host    A pointer to the instance of the {@link SCHost} to be destroyed (it must have been dynamically allocated).
+ * @param   host    A pointer to the instance of the {@link SCHost} to be destroyed (it must have been dynamically allocated). If it has been added to a {@link SCLoop}, it is removed from it: then, it must not be called from the callbacks of the hosts of the loop, nor while another thread runs the loop.
  */
 void schost_destroy(SCHost*);
 
+/**
+ * Dynamically allocates and initializes a new instance of the {@link SCLoop} structure.
+ *
+ * @return  A pointer to the new loop.
+ */
+SCLoop *sc_loop_create(void);
+
+/**
+ * Starts a host in a loop: works like {@link schost_start}, but the datagrams addressed to the host are received by the loop instead of new threads, from a socket shared by all the hosts of the loop on the same port (see {@link SCLoopPort}), and it does not wait for its own hello PDU (the address of the host is only known once the loop has received it). The loop must not be running on another thread.
+ *
+ * @param   loop    A pointer to the loop.
+ * @param   host    A pointer to the host to be started.
+ * @return  {@code 0} if the host has been started, {@code -1} if another host of the loop has the same port and chatID or if the port could not be bound (for example, because a host outside the loop uses it already): then the host can only be destroyed.
+ */
+int sc_loop_add(SCLoop*, SCHost*);
+
+/**
+ * Gets the descriptor of a loop, which becomes readable when {@link sc_loop_run_once} has something to do, so that the loop can be embedded in another event loop.
+ *
+ * @param   loop    A pointer to the loop.
+ * @return  The descriptor of the epoll instance of the loop (or {@code -1} if the loop uses poll).
+ */
+int sc_loop_descriptor(const SCLoop*);
+
+/**
+ * Waits for the datagrams addressed to the hosts of a loop (or for the next timer of one of them) and handles them, on the calling thread.
+ *
+ * @param   loop    A pointer to the loop.
+ * @param   timeout The maximum time to wait (in milliseconds): {@code 0} does not wait, {@code -1} waits until there is something to do.
+ * @return  The time (in milliseconds) until the next timer of a host of the loop (at most {@link SC_TICK_INTERVAL}), after which the function should be called again.
+ */
+int sc_loop_run_once(SCLoop*, int);
+
+/**
+ * Runs a loop on the calling thread until {@link sc_loop_stop} is called.
+ *
+ * @param   loop    A pointer to the loop.
+ */
+void sc_loop_run(SCLoop*);
+
+/**
+ * Makes {@link sc_loop_run} return (within {@link SC_TICK_INTERVAL} milliseconds, if it is called from another thread).
+ *
+ * @param   loop    A pointer to the loop.
+ */
+void sc_loop_stop(SCLoop*);
+
+/**
+ * Destroys an instance of the {@link SCLoop} structure created with {@link sc_loop_create} (the hosts which have been added to it must have been destroyed first).
+ *
+ * @param   loop    A pointer to the loop to be destroyed.
+ */
+void sc_loop_destroy(SCLoop*);
+
 #endif // SC_H 
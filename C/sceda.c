@@ -29,125 +29,289 @@
 
 #include "sceda.h"
 
-void sceda_func(unsigned char *output, const unsigned char *original, int blockC, const unsigned char *key, const unsigned char *iv, int decrypting) {
-	unsigned char blockKey[49], hashedBlockKey[16], *pt2;
+void sceda_func_block(unsigned char*, unsigned char*, const unsigned char*, const unsigned char*, int);
+
+void sceda_key_ctx_init(SCedaKeyCtx *ctx, const unsigned char *key) {
+	unsigned char tail[16];
+
+	memcpy(ctx->key, key, 16);
+	sceda_digest_init(&(ctx->keyDigest));
+	sceda_digest_update(&(ctx->keyDigest), key, 16);
+	tail[0] = 0;
+	tail[1] = 49 / 256;
+	tail[2] = 49 % 256;
+	memset(tail + 3, 170, 13);
+	sceda_digest_func(ctx->tailBlock, tail);
+}
+
+void sceda_func(unsigned char *output, const unsigned char *original, int blockC, const SCedaKeyCtx *ctx, const unsigned char *iv, int decrypting) {
+	unsigned char blockKey[32], *pt2;
+	ScedaDigestState digest;
 	const unsigned char *pt1;
-	int i, j;
+	int i;
 
-	memcpy(blockKey, key, 16);
+	/* The block key is the key, two variable blocks and a constant tail: only the two variable blocks are hashed here. */
+	memcpy(blockKey, iv, 8);
+	memcpy(blockKey + 8, iv, 8);
 	memcpy(blockKey + 16, iv, 8);
 	memcpy(blockKey + 24, iv, 8);
-	memcpy(blockKey + 32, iv, 8);
-	memcpy(blockKey + 40, iv, 8);
-	blockKey[48] = 0;
 
 	pt1 = original;
 	pt2 = output;
 	for(i = 0; i < blockC; i++) {
-		sceda_digest(hashedBlockKey, blockKey, 49);
-		if(decrypting) {
-			memcpy(blockKey + 16, pt1, 16);
-		} else {
-			memcpy(blockKey + 32, pt1, 16);
-		}
+		digest = ctx->keyDigest;
+		sceda_digest_update(&digest, blockKey, 32);
+		sceda_digest_chain(digest.state, ctx->tailBlock);
+		sceda_func_block(blockKey, pt2, pt1, digest.state, decrypting);
+		pt1 += 16;
+		pt2 += 16;
+	}
+}
 
-		for(j = 0; j < 16; j++) {
-			pt2[j] = pt1[j] ^ hashedBlockKey[j];
-		}
+void sceda_func_batch(unsigned char **outputs, const unsigned char **originals, const int *blockCs, const unsigned char **ivs, int count, const SCedaKeyCtx *ctx, int decrypting) {
+	unsigned char blockKeys[SCEDA_BATCH][32], variable[SCEDA_BATCH * 32], states[SCEDA_BATCH * 16];
+	int active[SCEDA_BATCH], group, n, i, j, k;
 
-		if(decrypting) {
-			memcpy(blockKey + 32, pt2, 16);
-		} else {
-			memcpy(blockKey + 16, pt2, 16);
+	/* Every message is a serial chain of blocks, but the messages of a group are independent, so the i-th blocks of all of them are hashed together. */
+	for(group = 0; group < count; group += SCEDA_BATCH) {
+		n = count - group;
+		if(n > SCEDA_BATCH) {
+			n = SCEDA_BATCH;
+		}
+		for(k = 0; k < n; k++) {
+			memcpy(blockKeys[k], ivs[group + k], 8);
+			memcpy(blockKeys[k] + 8, ivs[group + k], 8);
+			memcpy(blockKeys[k] + 16, ivs[group + k], 8);
+			memcpy(blockKeys[k] + 24, ivs[group + k], 8);
+		}
+		for(i = 0; ; i++) {
+			j = 0;
+			for(k = 0; k < n; k++) {
+				if(blockCs[group + k] > i) {
+					active[j++] = k;
+				}
+			}
+			if(!j) {
+				break;
+			}
+			for(k = 0; k < j; k++) {
+				memcpy(variable + 32 * k, blockKeys[active[k]], 32);
+				memcpy(states + 16 * k, ctx->keyDigest.state, 16);
+			}
+			sceda_digest_func_multi(variable, variable, 2 * j);
+			sceda_digest_chain_multi(states, variable, 32, j);
+			sceda_digest_chain_multi(states, variable + 16, 32, j);
+			sceda_digest_chain_multi(states, ctx->tailBlock, 0, j);
+			for(k = 0; k < j; k++) {
+				sceda_func_block(blockKeys[active[k]], outputs[group + active[k]] + 16 * i, originals[group + active[k]] + 16 * i, states + 16 * k, decrypting);
+			}
 		}
-		blockKey[32]++;
-		pt1 += 16;
-		pt2 += 16;
 	}
 }
 
-int sceda_encrypt(unsigned char *output, const unsigned char *original, int length, const unsigned char *key, const unsigned char *iv) {
+void sceda_func_block(unsigned char *blockKey, unsigned char *output, const unsigned char *original, const unsigned char *hashedBlockKey, int decrypting) {
+	int j;
+
+	if(decrypting) {
+		memcpy(blockKey, original, 16);
+	} else {
+		memcpy(blockKey + 16, original, 16);
+	}
+
+	for(j = 0; j < 16; j++) {
+		output[j] = original[j] ^ hashedBlockKey[j];
+	}
+
+	if(decrypting) {
+		memcpy(blockKey + 16, output, 16);
+	} else {
+		memcpy(blockKey, output, 16);
+	}
+	blockKey[16]++;
+}
+
+void sceda_reverse(unsigned char *buffer, int length) {
+	int i, temp;
+
+	for(i = 0; i < length/2; i++) {
+		temp = buffer[i];
+		buffer[i] = buffer[length-i-1];
+		buffer[length-i-1] = temp;
+	}
+}
+
+int sceda_encrypt_layout(unsigned char *output, const unsigned char *original, int length) {
 	int retVal, i, temp;
-	unsigned char *pt, *originalCopy;
+	unsigned char *pt;
 
-	srand(time(NULL) + rand());
-	originalCopy = (unsigned char*)malloc(length);
-	memcpy(originalCopy, original, length);
 	retVal = ((length+15)/16) * 16;
+	/* The message is moved first, since it may overlap with the header when encrypting in place. */
+	memmove(output + 7, original, length);
 	temp = length;
 	pt = output + 6;
 	for(i = 0; i < 7; i++) {
 		*pt-- = temp % 256;
 		temp /= 256;
 	}
-	pt += 8;
-	memcpy(pt, originalCopy, length);
-	pt += length;
-	for(i = 0; i < retVal - length + 9; i++) {
-		*(pt++) = rand();
+	pt += 8 + length;
+	csprng_fill(pt, retVal - length + 9);
+
+	return retVal;
+}
+
+int sceda_encrypted_header_length(const unsigned char *buffer, int length) {
+	unsigned long long retVal;
+	int i;
+	const unsigned char *pt;
+
+	/* The 7 bytes of the header do not fit in an int, so they are checked before being converted. */
+	pt = buffer;
+	retVal = 0;
+	for(i = 0; i < 7; i++) {
+		retVal *= 256;
+		retVal += *pt++;
+	}
+	if(length < 16 || retVal > (unsigned long long)(length - 16)) {
+		return -1;
 	}
+	return (int)retVal;
+}
+
+int sceda_encrypt(unsigned char *output, const unsigned char *original, int length, const unsigned char *key, const unsigned char *iv) {
+	SCedaKeyCtx ctx;
+
+	sceda_key_ctx_init(&ctx, key);
+	return sceda_encrypt_ctx(output, original, length, &ctx, iv);
+}
+
+int sceda_encrypt_ctx(unsigned char *output, const unsigned char *original, int length, const SCedaKeyCtx *ctx, const unsigned char *iv) {
+	int retVal;
+	unsigned char *pt;
+
+	retVal = sceda_encrypt_layout(output, original, length);
 	pt = output + 7;
-	sceda_func(pt, pt, (length+15) / 16, key, pt + retVal, 0);
+	sceda_func(pt, pt, (length+15) / 16, ctx, pt + retVal, 0);
 	retVal += 16;
-	for(i = 0; i < retVal/2; i++) {
-		temp = output[i];
-		output[i] = output[retVal-i-1];
-		output[retVal-i-1] = temp;
-	}
-	sceda_func(output, output, retVal / 16, key, iv, 0);
+	sceda_reverse(output, retVal);
+	sceda_func(output, output, retVal / 16, ctx, iv, 0);
 
-	free(originalCopy);
 	return retVal;
 }
 
+void sceda_encrypt_batch(unsigned char **outputs, const unsigned char **originals, const int *lengths, int count, const SCedaKeyCtx *ctx, const unsigned char **ivs) {
+	unsigned char *pts[SCEDA_BATCH];
+	const unsigned char *tailIVs[SCEDA_BATCH];
+	int blockCs[SCEDA_BATCH], group, n, k;
+
+	for(group = 0; group < count; group += SCEDA_BATCH) {
+		n = count - group;
+		if(n > SCEDA_BATCH) {
+			n = SCEDA_BATCH;
+		}
+		for(k = 0; k < n; k++) {
+			blockCs[k] = sceda_encrypt_layout(outputs[group + k], originals[group + k], lengths[group + k]) / 16;
+			pts[k] = outputs[group + k] + 7;
+			tailIVs[k] = pts[k] + 16 * blockCs[k];
+		}
+		sceda_func_batch(pts, (const unsigned char**)pts, blockCs, tailIVs, n, ctx, 0);
+		for(k = 0; k < n; k++) {
+			blockCs[k]++;
+			sceda_reverse(outputs[group + k], 16 * blockCs[k]);
+		}
+		sceda_func_batch(outputs + group, (const unsigned char**)(outputs + group), blockCs, ivs + group, n, ctx, 0);
+	}
+}
+
 int sceda_decrypt(unsigned char *output, const unsigned char *original, int length, const unsigned char *key, const unsigned char *iv) {
-	int retVal, i, temp;
-	unsigned char *pt, *buffer;
+	SCedaKeyCtx ctx;
+
+	sceda_key_ctx_init(&ctx, key);
+	return sceda_decrypt_ctx(output, original, length, &ctx, iv);
+}
+
+int sceda_decrypt_ctx(unsigned char *output, const unsigned char *original, int length, const SCedaKeyCtx *ctx, const unsigned char *iv) {
+	int retVal;
+	unsigned char *buffer;
 
 	if(length % 16) {
 		return -1;
 	}
 	buffer = (unsigned char*)malloc(length);
-	sceda_func(buffer, original, length / 16, key, iv, 1);
-	for(i = 0; i < length/2; i++) {
-		temp = buffer[i];
-		buffer[i] = buffer[length-i-1];
-		buffer[length-i-1] = temp;
+	memcpy(buffer, original, length);
+	retVal = sceda_decrypt_inplace(buffer, length, ctx, iv);
+	if(retVal > 0) {
+		memcpy(output, buffer, retVal);
 	}
-	pt = buffer;
-	retVal = 0;
-	for(i = 0; i < 7; i++) {
-		retVal *= 256;
-		retVal += *pt++;
+
+	free(buffer);
+	return retVal;
+}
+
+int sceda_decrypt_inplace(unsigned char *buffer, int length, const SCedaKeyCtx *ctx, const unsigned char *iv) {
+	int retVal;
+
+	if(length % 16) {
+		return -1;
 	}
-	if((retVal < 0) || (retVal > length-16)) {
+	sceda_func(buffer, buffer, length / 16, ctx, iv, 1);
+	sceda_reverse(buffer, length);
+	retVal = sceda_encrypted_header_length(buffer, length);
+	if(retVal < 0) {
 		return -1;
 	}
-	sceda_func(buffer, buffer + 7, (retVal+15) / 16, key, buffer + ((retVal+15)/16) * 16 + 7, 1);
-	memcpy(output, buffer, retVal);
+	sceda_func(buffer, buffer + 7, (retVal+15) / 16, ctx, buffer + ((retVal+15)/16) * 16 + 7, 1);
 
-	free(buffer);
 	return retVal;
 }
 
+void sceda_decrypt_batch(unsigned char **outputs, const unsigned char **originals, const int *lengths, int *results, int count, const SCedaKeyCtx *ctx, const unsigned char **ivs) {
+	unsigned char *outs[SCEDA_BATCH], *pts[SCEDA_BATCH];
+	const unsigned char *ins[SCEDA_BATCH], *tailIVs[SCEDA_BATCH];
+	int blockCs[SCEDA_BATCH], indexes[SCEDA_BATCH], group, n, m, k;
+
+	for(group = 0; group < count; group += SCEDA_BATCH) {
+		n = count - group;
+		if(n > SCEDA_BATCH) {
+			n = SCEDA_BATCH;
+		}
+		m = 0;
+		for(k = 0; k < n; k++) {
+			results[group + k] = -1;
+			if(!(lengths[group + k] % 16)) {
+				indexes[m] = group + k;
+				outs[m] = outputs[group + k];
+				ins[m] = originals[group + k];
+				tailIVs[m] = ivs[group + k];
+				blockCs[m++] = lengths[group + k] / 16;
+			}
+		}
+		sceda_func_batch(outs, ins, blockCs, tailIVs, m, ctx, 1);
+		n = m;
+		m = 0;
+		for(k = 0; k < n; k++) {
+			sceda_reverse(outs[k], 16 * blockCs[k]);
+			results[indexes[k]] = sceda_encrypted_header_length(outs[k], 16 * blockCs[k]);
+			if(results[indexes[k]] >= 0) {
+				indexes[m] = indexes[k];
+				pts[m] = outs[k];
+				ins[m] = outs[k] + 7;
+				blockCs[m] = (results[indexes[k]] + 15) / 16;
+				tailIVs[m] = outs[k] + blockCs[m] * 16 + 7;
+				m++;
+			}
+		}
+		sceda_func_batch(pts, ins, blockCs, tailIVs, m, ctx, 1);
+	}
+}
+
 int encrypted_length(int originalLength) {
 	return ((originalLength + 31) / 16) * 16;
 }
 
 void sceda_generate_key(unsigned char *output) {
-	int i;
-
-	srand(time(NULL) + rand());
-	for(i = 0; i < 16; i++) {
-		output[i] = rand();
-	}
+	csprng_fill(output, 16);
 }
 
 void sceda_generate_iv(unsigned char *output) {
-	int i;
-
-	srand(time(NULL) + rand());
-	for(i = 0; i < 8; i++) {
-		output[i] = rand();
-	}
+	csprng_fill(output, 8);
 }
@@ -32,9 +32,40 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
+#include "csprng.h"
 #include "digest.h"
 
+/**
+ * The number of messages the batched functions process together (longer batches are split into groups of this size).
+ */
+#define SCEDA_BATCH 16
+
+/**
+ * Holds the parts of the ScedaDigest computations performed by SCEDA which only depend on the key, so that they are computed once per key rather than once per block.
+ */
+struct SCedaKeyCtx {
+	unsigned char key[16];
+
+	/**
+	 * The state of ScedaDigest once the first block of a block key (which is the key itself) has been hashed.
+	 */
+	ScedaDigestState keyDigest;
+
+	/**
+	 * The compressed last block of every block key (which only holds its trailing byte and the padding), used to finalize the computation.
+	 */
+	unsigned char tailBlock[16];
+};
+typedef struct SCedaKeyCtx SCedaKeyCtx;
+
+/**
+ * Initializes an instance of the {@link SCedaKeyCtx} structure for the given key.
+ *
+ * @param   ctx     A pointer to the instance to be initialized.
+ * @param   key     A pointer to the key the context is prepared for (it must be 16 bytes long and it will be duplicated).
+ */
+void sceda_key_ctx_init(SCedaKeyCtx*, const unsigned char*);
+
 /**
  * Encrypts a message using SCEDA.
  *
@@ -47,6 +78,30 @@
  */
 int sceda_encrypt(unsigned char*, const unsigned char*, int, const unsigned char*, const unsigned char*);
 
+/**
+ * Encrypts a message using SCEDA with a key context prepared by {@link sceda_key_ctx_init} (the output is the same as the one of {@link sceda_encrypt}).
+ *
+ * @param   output      A pointer to the buffer to be written the output into.
+ * @param   original    A pointer to the binary representation of the message to be encrypted (it may be the same as {@code output}, to encrypt the message in place).
+ * @param   length      The length of the message to be encrypted.
+ * @param   ctx         A pointer to the context of the key to be used to encrypt the message.
+ * @param   iv          A pointer to the initialization vector to be used to encrypt the message (it must be 8 bytes long).
+ * @return  The length of the encrypted message.
+ */
+int sceda_encrypt_ctx(unsigned char*, const unsigned char*, int, const SCedaKeyCtx*, const unsigned char*);
+
+/**
+ * Encrypts several messages at once using SCEDA with the same key, hashing the blocks of different messages together (the outputs are the same as the ones of {@link sceda_encrypt_ctx}).
+ *
+ * @param   outputs     The buffers to be written the outputs into (the length of each output is the output of {@code encrypted_length} for the corresponding message).
+ * @param   originals   The binary representations of the messages to be encrypted.
+ * @param   lengths     The lengths of the messages to be encrypted.
+ * @param   count       The number of messages to be encrypted.
+ * @param   ctx         A pointer to the context of the key to be used to encrypt the messages.
+ * @param   ivs         The initialization vectors to be used to encrypt the messages (each of them must be 8 bytes long).
+ */
+void sceda_encrypt_batch(unsigned char**, const unsigned char**, const int*, int, const SCedaKeyCtx*, const unsigned char**);
+
 /**
  * Decrypts a message encrypted with SCEDA.
  *
@@ -59,6 +114,42 @@ int sceda_encrypt(unsigned char*, const unsigned char*, int, const unsigned char
  */
 int sceda_decrypt(unsigned char*, const unsigned char*, int, const unsigned char*, const unsigned char*);
 
+/**
+ * Decrypts a message encrypted with SCEDA with a key context prepared by {@link sceda_key_ctx_init}.
+ *
+ * @param   output      A pointer to the buffer to be written the output into.
+ * @param   original    A pointer to the binary message to be decrypted.
+ * @param   length      The length of the encrypted message.
+ * @param   ctx         A pointer to the context of the key used to encrypt the message.
+ * @param   iv          A pointer to the initialization vector used to encrypt the message (it must be 8 bytes long).
+ * @return  The length of the decrypted message (or {@code -1} if it could not be decrypted).
+ */
+int sceda_decrypt_ctx(unsigned char*, const unsigned char*, int, const SCedaKeyCtx*, const unsigned char*);
+
+/**
+ * Decrypts a message encrypted with SCEDA in place, without using any other buffer.
+ *
+ * @param   buffer  A pointer to the binary message to be decrypted, which is overwritten with the decrypted message (and some working data after it).
+ * @param   length  The length of the encrypted message.
+ * @param   ctx     A pointer to the context of the key used to encrypt the message.
+ * @param   iv      A pointer to the initialization vector used to encrypt the message (it must be 8 bytes long).
+ * @return  The length of the decrypted message (or {@code -1} if it could not be decrypted).
+ */
+int sceda_decrypt_inplace(unsigned char*, int, const SCedaKeyCtx*, const unsigned char*);
+
+/**
+ * Decrypts several messages encrypted with SCEDA with the same key at once, hashing the blocks of different messages together.
+ *
+ * @param   outputs     The buffers to be written the outputs into (each of them must be at least as long as the corresponding encrypted message, since it is also used as working space).
+ * @param   originals   The binary messages to be decrypted (each of them may be the same as the corresponding output).
+ * @param   lengths     The lengths of the encrypted messages.
+ * @param   results     The array to be written the lengths of the decrypted messages into (or {@code -1} for the messages which could not be decrypted).
+ * @param   count       The number of messages to be decrypted.
+ * @param   ctx         A pointer to the context of the key used to encrypt the messages.
+ * @param   ivs         The initialization vectors used to encrypt the messages (each of them must be 8 bytes long).
+ */
+void sceda_decrypt_batch(unsigned char**, const unsigned char**, const int*, int*, int, const SCedaKeyCtx*, const unsigned char**);
+
 /**
  * Guesses the length of an encrypted message by its length when non encrypted without actually encrypting it.
  *
@@ -0,0 +1,172 @@
+/*
+	Copyright (C) 2015 - Code written 100% by Valentino Giudice
+	E-mail: valentino.giudice96@gmail.com
+	Website: http://valentinogiudice.altervista.org/
+	Twitter: http://twitter.com/aspie96
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+	EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+	(This work is also licensed under the GNU General Public License as published by the Free Software Foundation, either version 2 of the License, or, at your option, any later version).
+*/
+
+#include "timer.h"
+
+#define SC_TIMER_SPAN(level) (1LL << (SC_TIMER_SLOT_BITS * (level)))
+
+void sctimer_unlink(SCTimer *timer) {
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->prev = 0;
+}
+
+void sctimerwheel_place(SCTimerWheel *wheel, SCTimer *timer) {
+	SCTimer *head;
+	long long delta, tick;
+	int level;
+
+	/* The level is chosen so that the slot is moved down (or the timer expires) before the slot index comes around again. */
+	tick = timer->expires < wheel->current ? wheel->current : timer->expires;
+	delta = tick - wheel->current;
+	if(delta >= SC_TIMER_SPAN(SC_TIMER_LEVELS)) {
+		/* Farther than the wheel can reach: the timer is placed again when its slot is moved down. */
+		tick = wheel->current + SC_TIMER_SPAN(SC_TIMER_LEVELS) - 1;
+		delta = tick - wheel->current;
+	}
+	for(level = 0; delta >= SC_TIMER_SPAN(level + 1); level++);
+	head = wheel->slots[level] + ((tick >> (SC_TIMER_SLOT_BITS * level)) & (SC_TIMER_SLOTS - 1));
+	timer->prev = head;
+	timer->next = head->next;
+	head->next->prev = timer;
+	head->next = timer;
+}
+
+void sctimerwheel_init(SCTimerWheel *wheel, int resolution, long long now) {
+	int level, slot;
+
+	wheel->resolution = resolution;
+	wheel->current = now / resolution;
+	wheel->count = 0;
+	for(level = 0; level < SC_TIMER_LEVELS; level++) {
+		for(slot = 0; slot < SC_TIMER_SLOTS; slot++) {
+			wheel->slots[level][slot].next = wheel->slots[level] + slot;
+			wheel->slots[level][slot].prev = wheel->slots[level] + slot;
+		}
+	}
+}
+
+void sctimerwheel_add(SCTimerWheel *wheel, SCTimer *timer, long long expires) {
+	timer->expires = (expires + wheel->resolution - 1) / wheel->resolution;
+	sctimerwheel_place(wheel, timer);
+	wheel->count++;
+}
+
+void sctimerwheel_remove(SCTimerWheel *wheel, SCTimer *timer) {
+	if(timer->prev) {
+		sctimer_unlink(timer);
+		wheel->count--;
+	}
+}
+
+int sctimerwheel_cascade(SCTimerWheel *wheel, int level) {
+	SCTimer *head, *timer;
+	int slot;
+
+	/* The timers of the slot of the current tick are moved to the lower levels: the index is returned, since the next level has to be cascaded as well when it wraps around to 0. */
+	slot = (wheel->current >> (SC_TIMER_SLOT_BITS * level)) & (SC_TIMER_SLOTS - 1);
+	head = wheel->slots[level] + slot;
+	while((timer = head->next) != head) {
+		sctimer_unlink(timer);
+		sctimerwheel_place(wheel, timer);
+	}
+	return slot;
+}
+
+SCTimer *sctimerwheel_advance(SCTimerWheel *wheel, long long now) {
+	SCTimer *retVal, *head, *timer;
+	long long tick;
+	int level;
+
+	retVal = 0;
+	tick = now / wheel->resolution;
+	while(wheel->current <= tick) {
+		if(wheel->count) {
+			for(level = 1; level < SC_TIMER_LEVELS && !(wheel->current & (SC_TIMER_SPAN(level) - 1)) && !sctimerwheel_cascade(wheel, level); level++);
+			head = wheel->slots[0] + (wheel->current & (SC_TIMER_SLOTS - 1));
+			while((timer = head->next) != head) {
+				sctimer_unlink(timer);
+				timer->next = retVal;
+				retVal = timer;
+				wheel->count--;
+			}
+		}
+		wheel->current++;
+	}
+	return retVal;
+}
+
+long long sctimerwheel_next(const SCTimerWheel *wheel) {
+	const SCTimer *head;
+	long long retVal, tick;
+	int level, slot;
+
+	if(!wheel->count) {
+		return -1;
+	}
+	/* The timers of the other levels are moved down at the beginning of a slot of the second level at the earliest. */
+	retVal = -1;
+	for(level = 1; level < SC_TIMER_LEVELS && retVal < 0; level++) {
+		for(slot = 0; slot < SC_TIMER_SLOTS; slot++) {
+			head = wheel->slots[level] + slot;
+			if(head->next != head) {
+				retVal = (wheel->current + SC_TIMER_SLOTS - 1) & ~(long long)(SC_TIMER_SLOTS - 1);
+				break;
+			}
+		}
+	}
+	/* Every slot of the first level holds a single tick of the next SC_TIMER_SLOTS ones. */
+	for(tick = wheel->current; tick < wheel->current + SC_TIMER_SLOTS && (retVal < 0 || tick < retVal); tick++) {
+		head = wheel->slots[0] + (tick & (SC_TIMER_SLOTS - 1));
+		if(head->next != head) {
+			retVal = tick;
+			break;
+		}
+	}
+	return retVal * wheel->resolution;
+}
+
+SCTimer *sctimerwheel_clear(SCTimerWheel *wheel) {
+	SCTimer *retVal, *head, *timer;
+	int level, slot;
+
+	retVal = 0;
+	for(level = 0; level < SC_TIMER_LEVELS; level++) {
+		for(slot = 0; slot < SC_TIMER_SLOTS; slot++) {
+			head = wheel->slots[level] + slot;
+			while((timer = head->next) != head) {
+				sctimer_unlink(timer);
+				timer->next = retVal;
+				retVal = timer;
+			}
+		}
+	}
+	wheel->count = 0;
+	return retVal;
+}
@@ -0,0 +1,123 @@
+/*
+	Copyright (C) 2015 - Code written 100% by Valentino Giudice
+	E-mail: valentino.giudice96@gmail.com
+	Website: http://valentinogiudice.altervista.org/
+	Twitter: http://twitter.com/aspie96
+
+	Permission is hereby granted, free of charge, to any person obtaining
+	a copy of this software and associated documentation files (the
+	"Software"), to deal in the Software without restriction, including
+	without limitation the rights to use, copy, modify, merge, publish,
+	distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to
+	the following conditions:
+
+	The above copyright notice and this permission notice shall be included
+	in all copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+	EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+	MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+	IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+	CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+	TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+	SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+	(This work is also licensed under the GNU General Public License as published by the Free Software Foundation, either version 2 of the License, or, at your option, any later version).
+*/
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#define SC_TIMER_LEVELS 4
+#define SC_TIMER_SLOT_BITS 6
+#define SC_TIMER_SLOTS (1 << SC_TIMER_SLOT_BITS)
+
+/**
+ * Represents a timer of a {@link SCTimerWheel} (it is meant to be embedded in the structure it refers to).
+ */
+struct SCTimer {
+	/**
+	 * The tick in which the timer expires.
+	 */
+	long long expires;
+
+	/**
+	 * The neighbours of the timer in its slot of the wheel ({@code prev} is {@code 0} if the timer is not in the wheel).
+	 */
+	struct SCTimer *next;
+	struct SCTimer *prev;
+};
+typedef struct SCTimer SCTimer;
+
+/**
+ * Represents a hierarchical timer wheel: each level has {@link SC_TIMER_SLOTS} slots, which are {@link SC_TIMER_SLOTS} times as long as the ones of the previous level, and the timers are moved to the lower levels as their expiration gets closer.
+ */
+struct SCTimerWheel {
+	/**
+	 * The length of a tick (in milliseconds), the next tick to be processed and the number of timers in the wheel.
+	 */
+	int resolution;
+	long long current;
+	int count;
+
+	/**
+	 * The list heads of the slots.
+	 */
+	SCTimer slots[SC_TIMER_LEVELS][SC_TIMER_SLOTS];
+};
+typedef struct SCTimerWheel SCTimerWheel;
+
+/**
+ * Initializes an empty timer wheel.
+ *
+ * @param   wheel       A pointer to the wheel to be initialized.
+ * @param   resolution  The length of a tick (in milliseconds).
+ * @param   now         The current time (in milliseconds).
+ */
+void sctimerwheel_init(SCTimerWheel*, int, long long);
+
+/**
+ * Adds a timer to a wheel (if it is in a wheel already, it must be removed first).
+ *
+ * @param   wheel   A pointer to the wheel.
+ * @param   timer   A pointer to the timer to be added.
+ * @param   expires The time the timer expires (in milliseconds: it is rounded up to the next tick).
+ */
+void sctimerwheel_add(SCTimerWheel*, SCTimer*, long long);
+
+/**
+ * Removes a timer from its wheel (nothing happens if it is not in a wheel).
+ *
+ * @param   wheel   A pointer to the wheel.
+ * @param   timer   A pointer to the timer to be removed.
+ */
+void sctimerwheel_remove(SCTimerWheel*, SCTimer*);
+
+/**
+ * Processes the ticks of a wheel up to the current time, in constant time for each of them.
+ *
+ * @param   wheel   A pointer to the wheel.
+ * @param   now     The current time (in milliseconds).
+ * @return  The list of the timers which have expired (linked by {@link SCTimer#next}), which are removed from the wheel.
+ */
+SCTimer *sctimerwheel_advance(SCTimerWheel*, long long);
+
+/**
+ * Finds the first tick of a wheel which has to be processed, so that the owner of the wheel can sleep until then.
+ *
+ * @param   wheel   A pointer to the wheel.
+ * @return  The time (in milliseconds) the next timer expires at, or an earlier time its slot has to be moved down at (or {@code -1} if the wheel is empty).
+ */
+long long sctimerwheel_next(const SCTimerWheel*);
+
+/**
+ * Removes all the timers from a wheel.
+ *
+ * @param   wheel   A pointer to the wheel.
+ * @return  The list of the timers which were in the wheel (linked by {@link SCTimer#next}).
+ */
+SCTimer *sctimerwheel_clear(SCTimerWheel*);
+
+#endif // TIMER_H